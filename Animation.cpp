@@ -10,441 +10,2818 @@
 #include "pch.h"
 #include "Animation.h"
 
+#include <DirectXPackedVector.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <deque>
 #include <fstream>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
 
 using namespace DX;
 using namespace DirectX;
 
 //--------------------------------------------------------------------------------------
-// DirectX SDK SDKMESH animation
+// File loading
 //--------------------------------------------------------------------------------------
 namespace
 {
-#pragma pack(push,8)
-
-    constexpr uint32_t SDKMESH_FILE_VERSION = 101;
-    constexpr uint32_t MAX_FRAME_NAME = 100;
+    struct handle_closer { void operator()(HANDLE h) noexcept { if (h) CloseHandle(h); } };
 
-    struct SDKANIMATION_FILE_HEADER
-    {
-        uint32_t Version;
-        uint8_t  IsBigEndian;
-        uint32_t FrameTransformType;
-        uint32_t NumFrames;
-        uint32_t NumAnimationKeys;
-        uint32_t AnimationFPS;
-        uint64_t AnimationDataSize;
-        uint64_t AnimationDataOffset;
-    };
+    using ScopedHandle = std::unique_ptr<void, handle_closer>;
 
-    static_assert(sizeof(SDKANIMATION_FILE_HEADER) == 40, "SDK Mesh structure size incorrect");
+    inline HANDLE safe_handle(HANDLE h) noexcept { return (h == INVALID_HANDLE_VALUE) ? nullptr : h; }
 
-    struct SDKANIMATION_DATA
+    // File contents from offset onwards, either read into a heap blob or mapped read-only
+    struct FileData
     {
-        XMFLOAT3 Translation;
-        XMFLOAT4 Orientation;
-        XMFLOAT3 Scaling;
+        std::unique_ptr<uint8_t[]>      blob;
+        std::shared_ptr<const uint8_t>  view;
+        const uint8_t*                  data = nullptr;
+        size_t                          size = 0;
     };
 
-    static_assert(sizeof(SDKANIMATION_DATA) == 40, "SDK Mesh structure size incorrect");
+    inline ScopedHandle OpenFileForRead(_In_z_ const wchar_t* fileName) noexcept
+    {
+#if (_WIN32_WINNT >= 0x0602 /*_WIN32_WINNT_WIN8*/)
+        return ScopedHandle(safe_handle(CreateFile2(fileName,
+            GENERIC_READ,
+            FILE_SHARE_READ,
+            OPEN_EXISTING,
+            nullptr)));
+#else
+        return ScopedHandle(safe_handle(CreateFileW(fileName,
+            GENERIC_READ,
+            FILE_SHARE_READ,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr)));
+#endif
+    }
 
-    struct SDKANIMATION_FRAME_DATA
+    // Reads at a 64-bit file offset without using the shared file pointer
+    HRESULT ReadFileAt(HANDLE hFile, uint64_t offset, _Out_writes_bytes_(size) void* dest, size_t size) noexcept
     {
-        char FrameName[MAX_FRAME_NAME];
-        union
+        auto ptr = static_cast<uint8_t*>(dest);
+        while (size > 0)
         {
-            uint64_t DataOffset;
-            SDKANIMATION_DATA* pAnimationData;
-        };
-    };
+            const auto bytes = static_cast<DWORD>(std::min<size_t>(size, 0x40000000));
 
-    static_assert(sizeof(SDKANIMATION_FRAME_DATA) == 112, "SDK Mesh structure size incorrect");
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = static_cast<DWORD>(offset);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
 
-#pragma pack(pop)
-}
+            DWORD bytesRead = 0;
+            if (!ReadFile(hFile, ptr, bytes, &bytesRead, &overlapped))
+                return HRESULT_FROM_WIN32(GetLastError());
 
-AnimationSDKMESH::AnimationSDKMESH() noexcept :
-    m_animTime(0.0),
-    m_animSize(0)
-{
-}
+            if (bytesRead != bytes)
+                return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
 
-HRESULT AnimationSDKMESH::Load(_In_z_ const wchar_t* fileName)
-{
-    Release();
+            ptr += bytes;
+            offset += bytes;
+            size -= bytes;
+        }
 
-    if (!fileName)
-        return E_INVALIDARG;
+        return S_OK;
+    }
 
-    std::ifstream inFile(fileName, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!inFile)
-        return E_FAIL;
+    // Pages of a mapped file are only read from disk when they are first touched
+    HRESULT MapFileData(_In_z_ const wchar_t* fileName, size_t offset, FileData& file)
+    {
+        ScopedHandle hFile = OpenFileForRead(fileName);
+        if (!hFile)
+            return HRESULT_FROM_WIN32(GetLastError());
 
-    const std::streampos len = inFile.tellg();
-    if (!inFile)
-        return E_FAIL;
+        LARGE_INTEGER fileSize = {};
+        if (!GetFileSizeEx(hFile.get(), &fileSize))
+            return HRESULT_FROM_WIN32(GetLastError());
 
-    if (len > UINT32_MAX)
-        return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+        if (uint64_t(fileSize.QuadPart) > SIZE_MAX)
+            return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
 
-    if (static_cast<size_t>(len) < sizeof(SDKANIMATION_FILE_HEADER))
-        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        const auto len = static_cast<size_t>(fileSize.QuadPart);
+        if (len <= offset)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
 
-    std::unique_ptr<uint8_t[]> blob(new (std::nothrow) uint8_t[size_t(len)]);
-    if (!blob)
-        return E_OUTOFMEMORY;
+        ScopedHandle hMapping(CreateFileMappingW(hFile.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+        if (!hMapping)
+            return HRESULT_FROM_WIN32(GetLastError());
 
-    inFile.seekg(0, std::ios::beg);
-    if (!inFile)
-        return E_FAIL;
+        auto ptr = static_cast<const uint8_t*>(MapViewOfFile(hMapping.get(), FILE_MAP_READ, 0, 0, 0));
+        if (!ptr)
+            return HRESULT_FROM_WIN32(GetLastError());
 
-    inFile.read(reinterpret_cast<char*>(blob.get()), len);
-    if (!inFile)
-        return E_FAIL;
+        // The view keeps the mapping alive after the handles are closed
+        file.view.reset(ptr, [](const uint8_t* p) { UnmapViewOfFile(p); });
+        file.data = ptr + offset;
+        file.size = len - offset;
 
-    inFile.close();
+        return S_OK;
+    }
 
-    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(blob.get());
+    HRESULT ReadFileData(_In_z_ const wchar_t* fileName, size_t offset, FileData& file)
+    {
+        std::ifstream inFile(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!inFile)
+            return E_FAIL;
 
-    if (header->Version != SDKMESH_FILE_VERSION
-        || header->IsBigEndian != 0
-        || header->FrameTransformType != 0 /*FTT_RELATIVE*/
-        || header->NumAnimationKeys == 0
-        || header->NumFrames == 0
-        || header->AnimationFPS == 0)
-        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        const std::streampos len = inFile.tellg();
+        if (!inFile)
+            return E_FAIL;
 
-    uint64_t dataSize = header->AnimationDataOffset + header->AnimationDataSize;
-    if (dataSize > uint64_t(len))
-        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        if (static_cast<uint64_t>(len) > SIZE_MAX)
+            return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
 
-    m_animData.swap(blob);
-    m_animSize = static_cast<size_t>(len);
+        if (static_cast<size_t>(len) <= offset)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
 
-    return S_OK;
-}
+        inFile.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+        if (!inFile)
+            return E_FAIL;
 
-bool AnimationSDKMESH::Bind(const Model& model)
-{
-    assert(m_animData && m_animSize > 0);
+        const size_t dataSize = static_cast<size_t>(len) - offset;
 
-    if (model.bones.empty())
-        return false;
+        std::unique_ptr<uint8_t[]> blob(new (std::nothrow) uint8_t[dataSize]);
+        if (!blob)
+            return E_OUTOFMEMORY;
+
+        inFile.read(reinterpret_cast<char*>(blob.get()), static_cast<std::streamsize>(dataSize));
+        if (!inFile)
+            return E_FAIL;
+
+        inFile.close();
+
+        file.data = blob.get();
+        file.size = dataSize;
+        file.blob = std::move(blob);
 
-    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData.get());
-    assert(header->Version == SDKMESH_FILE_VERSION);
-    auto frameData = reinterpret_cast<SDKANIMATION_FRAME_DATA*>(m_animData.get() + header->AnimationDataOffset);
+        return S_OK;
+    }
 
-    m_boneToTrack.resize(model.bones.size());
-    for (auto& it : m_boneToTrack)
+    inline HRESULT LoadFileData(_In_z_ const wchar_t* fileName, size_t offset, uint32_t flags, FileData& file)
     {
-        it = ModelBone::c_Invalid;
+        return (flags & AnimationLoader_MemoryMap)
+            ? MapFileData(fileName, offset, file)
+            : ReadFileData(fileName, offset, file);
     }
+}
+
+//--------------------------------------------------------------------------------------
+// Skeleton
+//--------------------------------------------------------------------------------------
+static_assert(AnimationSkeleton::c_InvalidBone == ModelBone::c_Invalid, "Invalid bone index mismatch");
 
-    bool result = false;
+AnimationSkeleton::AnimationSkeleton(const Model& model) :
+    m_id(0),
+    m_boneCount(0)
+{
+    const size_t nbones = model.bones.size();
 
-    for (size_t j = 0; j < header->NumFrames; ++j)
+    std::vector<uint32_t> parents(nbones);
+    std::vector<const wchar_t*> names(nbones);
+    for (size_t j = 0; j < nbones; ++j)
     {
-        uint64_t offset = sizeof(SDKANIMATION_FILE_HEADER) + frameData[j].DataOffset;
-        uint64_t end = offset + sizeof(SDKANIMATION_DATA) * uint64_t(header->NumAnimationKeys);
-        if (end > UINT32_MAX
-            || end > m_animSize)
-            throw std::runtime_error("Animation file invalid");
+        parents[j] = model.bones[j].parentIndex;
+        names[j] = model.bones[j].name.c_str();
+    }
 
-        frameData[j].pAnimationData = reinterpret_cast<SDKANIMATION_DATA*>(m_animData.get() + offset);
+    AnimationSkeletonDesc desc = {};
+    desc.boneCount = nbones;
+    desc.parents = parents.data();
+    desc.bindPose = model.boneMatrices.get();
+    desc.invBindPose = model.invBindPoseMatrices.get();
+    desc.names = names.data();
 
-        wchar_t frameName[MAX_FRAME_NAME] = {};
-        MultiByteToWideChar(CP_UTF8, 0, frameData[j].FrameName, -1, frameName, MAX_FRAME_NAME);
+    Initialize(desc);
+}
 
-        size_t count = 0;
-        for (const auto& it : model.bones)
+namespace
+{
+    // Reuses the skeleton built by the last Bind(model) so that the binding caches keep hitting. The
+    // pointer alone could match a new model allocated at the same address, so the hierarchy is compared too.
+    std::shared_ptr<const AnimationSkeleton> SkeletonForModel(
+        const Model& model,
+        const Model* lastModel,
+        const std::shared_ptr<const AnimationSkeleton>& last)
+    {
+        if (last && lastModel == &model && last->GetBoneCount() == model.bones.size())
         {
-            if (_wcsicmp(frameName, it.name.c_str()) == 0)
+            const uint32_t* parents = last->GetParents();
+
+            bool match = true;
+            for (size_t j = 0; j < model.bones.size(); ++j)
             {
-                m_boneToTrack[count] = static_cast<uint32_t>(j);
-                result = true;
-                break;
+                if (parents[j] != model.bones[j].parentIndex)
+                {
+                    match = false;
+                    break;
+                }
             }
 
-            ++count;
+            if (match)
+                return last;
         }
-    }
-
-    m_animBones = ModelBone::MakeArray(model.bones.size());
 
-    return result;
-}
-
-void AnimationSDKMESH::Update(float delta)
-{
-    m_animTime += static_cast<double>(delta);
+        return std::make_shared<AnimationSkeleton>(model);
+    }
 }
 
-_Use_decl_annotations_
-void AnimationSDKMESH::Apply(
-    const DirectX::Model& model,
-    size_t nbones,
-    XMMATRIX* boneTransforms) const
+namespace
 {
-    assert(m_animData && m_animSize > 0);
+    enum ScratchSlot
+    {
+        Scratch_Absolute = 0,
+        Scratch_Tracks,
+        Scratch_Palette,
+        Scratch_Count
+    };
 
-    if (!nbones || !boneTransforms)
+    // Scratch buffers are per-thread so that Apply can be called concurrently
+    XMMATRIX* GetThreadScratch(ScratchSlot slot, size_t count)
     {
-        throw std::invalid_argument("Bone transforms array required");
+        struct ScratchBuffer
+        {
+            ModelBone::TransformArray data;
+            size_t size = 0;
+        };
+
+        thread_local ScratchBuffer s_scratch[Scratch_Count];
+
+        auto& buffer = s_scratch[slot];
+        if (buffer.size < count)
+        {
+            buffer.data = ModelBone::MakeArray(count);
+            buffer.size = count;
+        }
+
+        return buffer.data.get();
     }
 
-    if (nbones < model.bones.size())
+    constexpr size_t c_HalfsPer3x4 = 12;
+
+    // Skinning transforms are expected to be rigid, since scale can't be represented. The dual part is
+    // half the translation times the rotation, and XMQuaternionMultiply(a, b) computes b * a.
+    inline void XM_CALLCONV StoreDualQuaternion(_Out_writes_(2) XMFLOAT4* dest, FXMMATRIX m) noexcept
     {
-        throw std::invalid_argument("Bone transforms array is too small");
+        const XMVECTOR real = XMQuaternionNormalize(XMQuaternionRotationMatrix(m));
+        const XMVECTOR translation = XMVectorAndInt(m.r[3], g_XMMask3);
+
+        XMStoreFloat4(dest, real);
+        XMStoreFloat4(dest + 1, XMVectorScale(XMQuaternionMultiply(real, translation), 0.5f));
     }
 
-    if (model.bones.empty())
+    inline XMMATRIX XM_CALLCONV LoadDualQuaternion(_In_reads_(2) const XMFLOAT4* src) noexcept
     {
-        throw std::runtime_error("Model is missing bones");
+        const XMVECTOR real = XMLoadFloat4(src);
+        const XMVECTOR dual = XMLoadFloat4(src + 1);
+        const XMVECTOR translation = XMVectorScale(XMQuaternionMultiply(XMQuaternionConjugate(real), dual), 2.f);
+
+        XMMATRIX m = XMMatrixRotationQuaternion(real);
+        m.r[3] = XMVectorSelect(g_XMIdentityR3, translation, g_XMSelect1110);
+        return m;
     }
 
-    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData.get());
-    assert(header->Version == SDKMESH_FILE_VERSION);
+    // Destination for skinning transforms, converting each bone to the palette format as it is computed
+    struct PaletteWriter
+    {
+        AnimationPalette_Format format;
+        void* dest;
 
-    // Determine animation time
-    auto tick = static_cast<uint32_t>(static_cast<double>(header->AnimationFPS) * m_animTime);
-    tick %= header->NumAnimationKeys;
+        void XM_CALLCONV operator()(size_t j, FXMMATRIX m) const
+        {
+            switch (format)
+            {
+            case AnimationPalette_Float4x4:
+                static_cast<XMMATRIX*>(dest)[j] = m;
+                break;
 
-    // Compute local bone transforms
-    auto frameData = reinterpret_cast<SDKANIMATION_FRAME_DATA*>(m_animData.get() + header->AnimationDataOffset);
+            case AnimationPalette_Float3x4:
+                XMStoreFloat3x4(static_cast<XMFLOAT3X4*>(dest) + j, m);
+                break;
 
-    for (size_t j = 0; j < nbones; ++j)
-    {
-        if (m_boneToTrack[j] == ModelBone::c_Invalid)
-        {
-            m_animBones[j] = model.boneMatrices[j];
+            case AnimationPalette_Half3x4:
+                {
+                    // Same layout as XMFLOAT3X4, the first three rows of the transpose
+                    const XMMATRIX t = XMMatrixTranspose(m);
+                    auto half = reinterpret_cast<PackedVector::XMHALF4*>(
+                        static_cast<PackedVector::HALF*>(dest) + j * c_HalfsPer3x4);
+                    PackedVector::XMStoreHalf4(half, t.r[0]);
+                    PackedVector::XMStoreHalf4(half + 1, t.r[1]);
+                    PackedVector::XMStoreHalf4(half + 2, t.r[2]);
+                }
+                break;
+
+            case AnimationPalette_DualQuaternion:
+                StoreDualQuaternion(static_cast<XMFLOAT4*>(dest) + j * 2, m);
+                break;
+
+            default:
+                throw std::invalid_argument("Unknown palette format");
+            }
         }
-        else
+    };
+
+    inline XMMATRIX LoadPaletteBone(AnimationPalette_Format format, _In_ const void* src, size_t j)
+    {
+        switch (format)
         {
-            auto frame = &frameData[m_boneToTrack[j]];
-            auto data = &frame->pAnimationData[tick];
+        case AnimationPalette_Float4x4:
+            return static_cast<const XMMATRIX*>(src)[j];
 
-            XMVECTOR quat = XMVectorSet(data->Orientation.x, data->Orientation.y, data->Orientation.z, data->Orientation.w);
-            if (XMVector4Equal(quat, g_XMZero))
-                quat = XMQuaternionIdentity();
-            else
-                quat = XMQuaternionNormalize(quat);
+        case AnimationPalette_Float3x4:
+            return XMLoadFloat3x4(static_cast<const XMFLOAT3X4*>(src) + j);
 
-            XMMATRIX trans = XMMatrixTranslation(data->Translation.x, data->Translation.y, data->Translation.z);
-            XMMATRIX rotation = XMMatrixRotationQuaternion(quat);
-            XMMATRIX scale = XMMatrixScaling(data->Scaling.x, data->Scaling.y, data->Scaling.z);
+        case AnimationPalette_Half3x4:
+            {
+                auto half = reinterpret_cast<const PackedVector::XMHALF4*>(
+                    static_cast<const PackedVector::HALF*>(src) + j * c_HalfsPer3x4);
+                const XMMATRIX t(
+                    PackedVector::XMLoadHalf4(half),
+                    PackedVector::XMLoadHalf4(half + 1),
+                    PackedVector::XMLoadHalf4(half + 2),
+                    g_XMIdentityR3);
+                return XMMatrixTranspose(t);
+            }
 
-            m_animBones[j] = XMMatrixMultiply(XMMatrixMultiply(rotation, scale), trans);
+        case AnimationPalette_DualQuaternion:
+            return LoadDualQuaternion(static_cast<const XMFLOAT4*>(src) + j * 2);
+
+        default:
+            throw std::invalid_argument("Unknown palette format");
         }
     }
 
-    // Compute absolute locations
-    model.CopyAbsoluteBoneTransforms(nbones, m_animBones.get(), boneTransforms);
-
-    // Adjust for model's bind pose.
-    for (size_t j = 0; j < nbones; ++j)
+    void ValidatePalette(const Model& model, size_t nbones, const void* palette)
     {
-        boneTransforms[j] = XMMatrixMultiply(model.invBindPoseMatrices[j], boneTransforms[j]);
+        if (!nbones || !palette)
+        {
+            throw std::invalid_argument("Bone transforms array required");
+        }
+
+        if (nbones < model.bones.size())
+        {
+            throw std::invalid_argument("Bone transforms array is too small");
+        }
+
+        if (model.bones.empty())
+        {
+            throw std::runtime_error("Model is missing bones");
+        }
     }
 }
 
-
 //--------------------------------------------------------------------------------------
-// Visual Studio Starter Kit CMO animation
+// Compressed tracks
 //--------------------------------------------------------------------------------------
 namespace
 {
-#pragma pack(push,1)
+    // The three smallest components of a unit quaternion are within +/- 1/sqrt(2)
+    constexpr float c_SmallestThreeRange = 0.70710678f;
 
-    struct Clip
+    template<typename T>
+    void AppendValue(std::vector<uint8_t>& data, const T& value)
     {
-        float StartTime;
-        float EndTime;
-        uint32_t keys;
-    };
-
-    static_assert(sizeof(Clip) == 12, "CMO Mesh structure size incorrect");
+        const size_t offset = data.size();
+        data.resize(offset + sizeof(T));
+        memcpy(data.data() + offset, &value, sizeof(T));
+    }
 
-    struct Keyframe
+    // Channel data starts on a 4-byte boundary so the float ranges can be loaded directly
+    inline uint32_t AlignChannel(std::vector<uint8_t>& data)
     {
-        uint32_t BoneIndex;
-        float Time;
-        DirectX::XMFLOAT4X4 Transform;
-    };
-
-    static_assert(sizeof(Keyframe) == 72, "CMO Mesh structure size incorrect");
-
-#pragma pack(pop)
-}
-
-AnimationCMO::AnimationCMO() noexcept :
-    m_animTime(0.f),
-    m_startTime(0.f),
-    m_endTime(0.f)
-{
-}
-
-_Use_decl_annotations_
-HRESULT AnimationCMO::Load(const wchar_t* fileName, size_t offset, const wchar_t* clipName)
-{
-    if (!fileName || !offset)
-        return E_INVALIDARG;
-
-    std::ifstream inFile(fileName, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!inFile)
-        return E_FAIL;
-
-    const std::streampos len = inFile.tellg();
-    if (!inFile)
-        return E_FAIL;
-
-    if (len > UINT32_MAX)
-        return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+        data.resize((data.size() + 3) & ~size_t(3));
 
-    inFile.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
-    if (!inFile)
-        return E_FAIL;
+        if (data.size() > UINT32_MAX)
+            throw std::overflow_error("Compressed track data too large");
 
-    auto remaining = len - static_cast<std::streamoff>(offset);
+        return static_cast<uint32_t>(data.size());
+    }
 
-    auto dataSize = static_cast<size_t>(remaining);
-    if (dataSize < sizeof(uint32_t))
-        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+    inline uint64_t PackSmallestThree(const XMFLOAT4& quat, uint32_t bits) noexcept
+    {
+        const float c[4] = { quat.x, quat.y, quat.z, quat.w };
 
-    std::unique_ptr<uint8_t[]> blob(new (std::nothrow) uint8_t[dataSize]);
-    if (!blob)
-        return E_OUTOFMEMORY;
+        uint32_t largest = 0;
+        for (uint32_t j = 1; j < 4; ++j)
+        {
+            if (fabsf(c[j]) > fabsf(c[largest]))
+                largest = j;
+        }
 
-    inFile.read(reinterpret_cast<char*>(blob.get()), remaining);
-    if (!inFile)
-        return E_FAIL;
+        // q and -q are the same rotation, so flip the sign to make the dropped component positive
+        const float sign = (c[largest] < 0.f) ? -1.f : 1.f;
+        const float levels = float((1u << bits) - 1);
 
-    inFile.close();
+        uint64_t packed = largest;
+        for (uint32_t j = 0; j < 4; ++j)
+        {
+            if (j == largest)
+                continue;
 
-    auto nClips = reinterpret_cast<const uint32_t*>(blob.get());
-    size_t usedSize = sizeof(uint32_t);
-    if (dataSize < usedSize)
-        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            float v = (c[j] * sign + c_SmallestThreeRange) / (2.f * c_SmallestThreeRange);
+            v = std::min(std::max(v, 0.f), 1.f);
+            packed = (packed << bits) | static_cast<uint64_t>(v * levels + 0.5f);
+        }
 
-    if (!nClips)
-        return E_FAIL;
+        return packed;
+    }
 
-    for (size_t j = 0; j < *nClips; ++j)
+    inline XMVECTOR XM_CALLCONV UnpackSmallestThree(uint64_t packed, uint32_t bits) noexcept
     {
-        // Clip name
-        auto nName = reinterpret_cast<const uint32_t*>(blob.get() + usedSize);
-        usedSize += sizeof(uint32_t);
-        if (dataSize < usedSize)
-            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
-
-        auto name = reinterpret_cast<const wchar_t*>(blob.get() + usedSize);
-
-        usedSize += sizeof(wchar_t) * (*nName);
-        if (dataSize < usedSize)
-            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
-
-        auto clip = reinterpret_cast<const Clip*>(blob.get() + usedSize);
-        usedSize += sizeof(Clip);
-        if (dataSize < usedSize)
-            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
-
-        if (!clip->keys)
-            return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        const uint64_t mask = (uint64_t(1) << bits) - 1;
+        const float scale = 2.f * c_SmallestThreeRange / float(mask);
 
-        auto keys = reinterpret_cast<const Keyframe*>(blob.get() + usedSize);
-        usedSize += sizeof(Keyframe) * clip->keys;
-        if (dataSize < usedSize)
-            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        const auto largest = static_cast<uint32_t>(packed >> (3 * bits)) & 0x3;
 
-        if (!clipName || _wcsicmp(clipName, name) == 0)
+        float c[4] = {};
+        float sum = 0.f;
+        uint32_t shift = 2 * bits;
+        for (uint32_t j = 0; j < 4; ++j)
         {
-            m_startTime = clip->StartTime;
-            m_endTime = clip->EndTime;
-
-            m_keys.resize(clip->keys);
-            m_transforms = ModelBone::MakeArray(clip->keys);
-
-            for (size_t k = 0; k < clip->keys; ++k)
-            {
-                m_keys[k].first = keys[k].BoneIndex;
-                m_keys[k].second = keys[k].Time;
-                m_transforms[k] = XMLoadFloat4x4(&keys[k].Transform);
-            }
+            if (j == largest)
+                continue;
 
-            return S_OK;
+            c[j] = float((packed >> shift) & mask) * scale - c_SmallestThreeRange;
+            sum += c[j] * c[j];
+            shift -= bits;
         }
-    }
 
-    return E_FAIL;
-}
+        c[largest] = sqrtf(std::max(0.f, 1.f - sum));
 
-void AnimationCMO::Bind(const Model& model)
-{
-    assert(!m_keys.empty());
+        return XMVectorSet(c[0], c[1], c[2], c[3]);
+    }
 
-    m_animBones = ModelBone::MakeArray(model.bones.size());
-}
+    inline uint64_t ReadSmallestThree48(const uint8_t* ptr) noexcept
+    {
+        uint16_t words[3];
+        memcpy(words, ptr, sizeof(words));
+        return uint64_t(words[0]) | (uint64_t(words[1]) << 16) | (uint64_t(words[2]) << 32);
+    }
 
-void AnimationCMO::Update(float delta)
-{
-    m_animTime += delta;
-    if (m_animTime > m_endTime)
+    inline float QuaternionError(const XMFLOAT4& a, FXMVECTOR b) noexcept
     {
-        m_animTime -= m_endTime;
+        XMVECTOR q = XMLoadFloat4(&a);
+        if (XMVectorGetX(XMVector4Dot(q, b)) < 0.f)
+        {
+            q = XMVectorNegate(q);
+        }
+
+        XMFLOAT4 diff;
+        XMStoreFloat4(&diff, XMVectorAbs(XMVectorSubtract(q, b)));
+        return std::max(std::max(diff.x, diff.y), std::max(diff.z, diff.w));
     }
 }
 
 _Use_decl_annotations_
-void AnimationCMO::Apply(
-    const Model& model,
-    size_t nbones,
-    XMMATRIX* boneTransforms) const
+uint32_t AnimationCompressedTracks::AddTrack(
+    size_t keyCount,
+    const XMFLOAT3* translations,
+    const XMFLOAT4* rotations,
+    const XMFLOAT3* scales,
+    float tolerance)
 {
-    assert(!m_keys.empty());
-
-    if (!nbones || !boneTransforms)
+    if (keyCount > 0 && (!translations || !rotations || !scales))
     {
-        throw std::invalid_argument("Bone transforms array required");
+        throw std::invalid_argument("Track keys required");
     }
 
-    if (nbones < model.bones.size())
+    if (!(tolerance > 0.f))
     {
-        throw std::invalid_argument("Bone transforms array is too small");
+        throw std::invalid_argument("Tolerance must be positive");
     }
 
-    if (model.bones.empty())
+    if (keyCount > UINT32_MAX || m_tracks.size() >= UINT32_MAX)
     {
-        throw std::runtime_error("Model is missing bones");
+        throw std::overflow_error("Too many keys or tracks");
     }
 
-    // Compute local bone transforms
-    model.CopyBoneTransformsTo(nbones, m_animBones.get());
+    Track track = {};
+    track.keyCount = static_cast<uint32_t>(keyCount);
 
-
-    // Apply keyframes
-    if (m_animTime >= m_startTime)
+    if (keyCount > 0)
     {
-        size_t k = 0;
-        for (auto kit : m_keys)
-        {
-            if (kit.second > m_animTime)
+        track.translation = EncodeVector3(translations, keyCount, tolerance);
+        track.rotation = EncodeQuaternion(rotations, keyCount, tolerance);
+        track.scale = EncodeVector3(scales, keyCount, tolerance);
+    }
+
+    m_tracks.push_back(track);
+
+    return static_cast<uint32_t>(m_tracks.size() - 1);
+}
+
+// Range-quantizes to 8 or 16 bits per component when that is within the tolerance
+_Use_decl_annotations_
+AnimationCompressedTracks::Channel AnimationCompressedTracks::EncodeVector3(
+    const XMFLOAT3* values,
+    size_t count,
+    float tolerance)
+{
+    XMVECTOR vmin = XMLoadFloat3(&values[0]);
+    XMVECTOR vmax = vmin;
+    for (size_t j = 1; j < count; ++j)
+    {
+        const XMVECTOR v = XMLoadFloat3(&values[j]);
+        vmin = XMVectorMin(vmin, v);
+        vmax = XMVectorMax(vmax, v);
+    }
+
+    const XMVECTOR extent = XMVectorSubtract(vmax, vmin);
+
+    XMFLOAT3 range;
+    XMStoreFloat3(&range, extent);
+    const float maxExtent = std::max(std::max(range.x, range.y), range.z);
+
+    Channel channel = {};
+    channel.offset = AlignChannel(m_data);
+
+    if (maxExtent <= 2.f * tolerance)
+    {
+        // The midpoint is within the tolerance of every key
+        XMFLOAT3 center;
+        XMStoreFloat3(&center, XMVectorLerp(vmin, vmax, 0.5f));
+
+        channel.encoding = Encoding_Constant;
+        AppendValue(m_data, center);
+        return channel;
+    }
+
+    for (const uint32_t bits : { 8u, 16u })
+    {
+        const float levels = float((1u << bits) - 1);
+        if (maxExtent / levels * 0.5f > tolerance)
+            continue;
+
+        const XMVECTOR step = XMVectorScale(extent, 1.f / levels);
+        const XMVECTOR invStep = XMVectorSelect(XMVectorReciprocal(step), g_XMZero,
+            XMVectorEqual(step, g_XMZero));
+
+        XMFLOAT3 tmp;
+        XMStoreFloat3(&tmp, vmin);
+        AppendValue(m_data, tmp);
+        XMStoreFloat3(&tmp, step);
+        AppendValue(m_data, tmp);
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            XMVECTOR q = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&values[j]), vmin), invStep);
+            q = XMVectorRound(XMVectorClamp(q, g_XMZero, XMVectorReplicate(levels)));
+
+            XMFLOAT3 quant;
+            XMStoreFloat3(&quant, q);
+
+            if (bits == 8)
+            {
+                AppendValue(m_data, static_cast<uint8_t>(quant.x));
+                AppendValue(m_data, static_cast<uint8_t>(quant.y));
+                AppendValue(m_data, static_cast<uint8_t>(quant.z));
+            }
+            else
+            {
+                AppendValue(m_data, static_cast<uint16_t>(quant.x));
+                AppendValue(m_data, static_cast<uint16_t>(quant.y));
+                AppendValue(m_data, static_cast<uint16_t>(quant.z));
+            }
+        }
+
+        channel.encoding = (bits == 8) ? Encoding_Quantized8 : Encoding_Quantized16;
+        return channel;
+    }
+
+    channel.encoding = Encoding_Raw;
+    for (size_t j = 0; j < count; ++j)
+    {
+        AppendValue(m_data, values[j]);
+    }
+
+    return channel;
+}
+
+// Smallest-three encoding drops the largest component and rebuilds it from the unit length.
+// The error is measured on every key since it isn't uniform across the range.
+_Use_decl_annotations_
+AnimationCompressedTracks::Channel AnimationCompressedTracks::EncodeQuaternion(
+    const XMFLOAT4* values,
+    size_t count,
+    float tolerance)
+{
+    Channel channel = {};
+    channel.offset = AlignChannel(m_data);
+
+    const XMVECTOR first = XMLoadFloat4(&values[0]);
+
+    float maxError = 0.f;
+    for (size_t j = 1; j < count && maxError <= tolerance; ++j)
+    {
+        maxError = std::max(maxError, QuaternionError(values[j], first));
+    }
+
+    if (maxError <= tolerance)
+    {
+        channel.encoding = Encoding_Constant;
+        AppendValue(m_data, values[0]);
+        return channel;
+    }
+
+    std::vector<uint64_t> packed(count);
+
+    for (const uint32_t bits : { 10u, 15u })
+    {
+        maxError = 0.f;
+        for (size_t j = 0; j < count && maxError <= tolerance; ++j)
+        {
+            packed[j] = PackSmallestThree(values[j], bits);
+            maxError = std::max(maxError, QuaternionError(values[j], UnpackSmallestThree(packed[j], bits)));
+        }
+
+        if (maxError > tolerance)
+            continue;
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            if (bits == 10)
+            {
+                AppendValue(m_data, static_cast<uint32_t>(packed[j]));
+            }
+            else
+            {
+                AppendValue(m_data, static_cast<uint16_t>(packed[j]));
+                AppendValue(m_data, static_cast<uint16_t>(packed[j] >> 16));
+                AppendValue(m_data, static_cast<uint16_t>(packed[j] >> 32));
+            }
+        }
+
+        channel.encoding = (bits == 10) ? Encoding_SmallestThree32 : Encoding_SmallestThree48;
+        return channel;
+    }
+
+    channel.encoding = Encoding_Raw;
+    for (size_t j = 0; j < count; ++j)
+    {
+        AppendValue(m_data, values[j]);
+    }
+
+    return channel;
+}
+
+_Use_decl_annotations_
+void AnimationCompressedTracks::Decompress(
+    uint32_t track,
+    uint32_t key,
+    XMVECTOR* translation,
+    XMVECTOR* rotation,
+    XMVECTOR* scale) const
+{
+    assert(track < m_tracks.size());
+    assert(translation && rotation && scale);
+
+    const Track& t = m_tracks[track];
+    assert(key < t.keyCount);
+
+    *translation = DecodeVector3(t.translation, key);
+    *scale = DecodeVector3(t.scale, key);
+
+    const uint8_t* ptr = m_data.data() + t.rotation.offset;
+    switch (t.rotation.encoding)
+    {
+    case Encoding_Constant:
+        *rotation = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(ptr));
+        break;
+
+    case Encoding_SmallestThree32:
+        {
+            uint32_t packed;
+            memcpy(&packed, ptr + sizeof(uint32_t) * key, sizeof(packed));
+            *rotation = UnpackSmallestThree(packed, 10);
+        }
+        break;
+
+    case Encoding_SmallestThree48:
+        *rotation = UnpackSmallestThree(ReadSmallestThree48(ptr + sizeof(uint16_t) * 3 * key), 15);
+        break;
+
+    default:
+        *rotation = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(ptr) + key);
+        break;
+    }
+}
+
+XMVECTOR XM_CALLCONV AnimationCompressedTracks::DecodeVector3(const Channel& channel, uint32_t key) const noexcept
+{
+    const uint8_t* ptr = m_data.data() + channel.offset;
+    auto floats = reinterpret_cast<const XMFLOAT3*>(ptr);
+
+    switch (channel.encoding)
+    {
+    case Encoding_Constant:
+        return XMLoadFloat3(floats);
+
+    case Encoding_Quantized8:
+        {
+            const uint8_t* q = ptr + sizeof(XMFLOAT3) * 2 + 3 * size_t(key);
+            const XMVECTOR v = XMVectorSet(float(q[0]), float(q[1]), float(q[2]), 0.f);
+            return XMVectorMultiplyAdd(v, XMLoadFloat3(&floats[1]), XMLoadFloat3(&floats[0]));
+        }
+
+    case Encoding_Quantized16:
+        {
+            uint16_t q[3];
+            memcpy(q, ptr + sizeof(XMFLOAT3) * 2 + sizeof(q) * size_t(key), sizeof(q));
+            const XMVECTOR v = XMVectorSet(float(q[0]), float(q[1]), float(q[2]), 0.f);
+            return XMVectorMultiplyAdd(v, XMLoadFloat3(&floats[1]), XMLoadFloat3(&floats[0]));
+        }
+
+    default:
+        return XMLoadFloat3(&floats[key]);
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// DirectX SDK SDKMESH animation
+//--------------------------------------------------------------------------------------
+namespace
+{
+#pragma pack(push,8)
+
+    constexpr uint32_t SDKMESH_FILE_VERSION = 101;
+    constexpr uint32_t MAX_FRAME_NAME = 100;
+
+    struct SDKANIMATION_FILE_HEADER
+    {
+        uint32_t Version;
+        uint8_t  IsBigEndian;
+        uint32_t FrameTransformType;
+        uint32_t NumFrames;
+        uint32_t NumAnimationKeys;
+        uint32_t AnimationFPS;
+        uint64_t AnimationDataSize;
+        uint64_t AnimationDataOffset;
+    };
+
+    static_assert(sizeof(SDKANIMATION_FILE_HEADER) == 40, "SDK Mesh structure size incorrect");
+
+    struct SDKANIMATION_DATA
+    {
+        XMFLOAT3 Translation;
+        XMFLOAT4 Orientation;
+        XMFLOAT3 Scaling;
+    };
+
+    static_assert(sizeof(SDKANIMATION_DATA) == 40, "SDK Mesh structure size incorrect");
+
+    struct SDKANIMATION_FRAME_DATA
+    {
+        char FrameName[MAX_FRAME_NAME];
+        uint64_t DataOffset;
+    };
+
+    static_assert(sizeof(SDKANIMATION_FRAME_DATA) == 112, "SDK Mesh structure size incorrect");
+
+#pragma pack(pop)
+
+    // The file image is never modified, so track data is located from the frame's offset on demand
+    inline const SDKANIMATION_DATA* GetTrackData(const uint8_t* animData, const SDKANIMATION_FRAME_DATA& frame) noexcept
+    {
+        return reinterpret_cast<const SDKANIMATION_DATA*>(animData + sizeof(SDKANIMATION_FILE_HEADER) + frame.DataOffset);
+    }
+
+    inline XMVECTOR XM_CALLCONV LoadOrientation(const SDKANIMATION_DATA& data) noexcept
+    {
+        const XMVECTOR quat = XMLoadFloat4(&data.Orientation);
+        if (XMVector4Equal(quat, g_XMZero))
+            return XMQuaternionIdentity();
+
+        return XMQuaternionNormalize(quat);
+    }
+
+    // SDKMESH keys are composed as rotation * scale * translation, unlike ComposeLocalTransform
+    inline XMMATRIX XM_CALLCONV ComposeKeyTransform(FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation) noexcept
+    {
+        return XMMatrixMultiply(
+            XMMatrixMultiply(XMMatrixRotationQuaternion(rotation), XMMatrixScalingFromVector(scale)),
+            XMMatrixTranslationFromVector(translation));
+    }
+
+    inline XMMATRIX XM_CALLCONV KeyToMatrix(const SDKANIMATION_DATA& data) noexcept
+    {
+        return ComposeKeyTransform(XMLoadFloat3(&data.Scaling), LoadOrientation(data), XMLoadFloat3(&data.Translation));
+    }
+
+    // Transcoded streams per tick: 4 rotation, 3 translation, and 3 scale vectors per group of 4 tracks
+    constexpr size_t c_SoARotation = 4;
+    constexpr size_t c_SoATranslation = 3;
+    constexpr size_t c_SoAScale = 3;
+    constexpr size_t c_SoAVectorsPerGroup = c_SoARotation + c_SoATranslation + c_SoAScale;
+}
+
+AnimationClipSDKMESH::AnimationClipSDKMESH() noexcept :
+    m_animData(nullptr),
+    m_animSize(0),
+    m_trackGroups(0)
+{
+}
+
+_Use_decl_annotations_
+HRESULT AnimationClipSDKMESH::CreateFromFile(
+    const wchar_t* fileName,
+    std::shared_ptr<const AnimationClipSDKMESH>& clip,
+    uint32_t flags,
+    float tolerance)
+{
+    clip.reset();
+
+    if (!fileName)
+        return E_INVALIDARG;
+
+    if (flags & AnimationLoader_Compress)
+    {
+        if ((flags & AnimationLoader_TranscodeSoA) || !(tolerance > 0.f))
+            return E_INVALIDARG;
+    }
+
+    FileData file;
+    HRESULT hr = LoadFileData(fileName, 0, flags, file);
+    if (FAILED(hr))
+        return hr;
+
+    const uint64_t len = file.size;
+    if (len < sizeof(SDKANIMATION_FILE_HEADER))
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+    // Validation only reads the header and frame table, so a mapped file's track data isn't paged in
+    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(file.data);
+
+    if (header->Version != SDKMESH_FILE_VERSION
+        || header->IsBigEndian != 0
+        || header->FrameTransformType != 0 /*FTT_RELATIVE*/
+        || header->NumAnimationKeys == 0
+        || header->NumFrames == 0
+        || header->AnimationFPS == 0)
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+    // Offsets come from the file, so compare before subtracting rather than adding them up
+    if (header->AnimationDataOffset > len
+        || header->AnimationDataSize > len - header->AnimationDataOffset)
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+    const uint64_t keyBytes = sizeof(SDKANIMATION_DATA) * uint64_t(header->NumAnimationKeys);
+
+    if (sizeof(SDKANIMATION_FRAME_DATA) * uint64_t(header->NumFrames) > len - header->AnimationDataOffset)
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+    // Validate all track data up front so binding and playback can trust the offsets
+    auto frameData = reinterpret_cast<const SDKANIMATION_FRAME_DATA*>(file.data + header->AnimationDataOffset);
+
+    for (size_t j = 0; j < header->NumFrames; ++j)
+    {
+        const uint64_t offset = sizeof(SDKANIMATION_FILE_HEADER) + frameData[j].DataOffset;
+        if (keyBytes > len || frameData[j].DataOffset > len || offset > len - keyBytes)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+    }
+
+    std::shared_ptr<AnimationClipSDKMESH> result(new (std::nothrow) AnimationClipSDKMESH);
+    if (!result)
+        return E_OUTOFMEMORY;
+
+    // Convert track names once so binding is just a hash lookup per track
+    result->m_trackNames.reserve(header->NumFrames);
+    for (size_t j = 0; j < header->NumFrames; ++j)
+    {
+        wchar_t frameName[MAX_FRAME_NAME] = {};
+        MultiByteToWideChar(CP_UTF8, 0, frameData[j].FrameName, -1, frameName, MAX_FRAME_NAME);
+        frameName[MAX_FRAME_NAME - 1] = 0;
+
+        result->m_trackNames.emplace_back(AnimationSkeleton::FoldName(frameName));
+    }
+
+    result->m_animBlob = std::move(file.blob);
+    result->m_fileView = std::move(file.view);
+    result->m_animData = file.data;
+    result->m_animSize = file.size;
+
+    if (flags & AnimationLoader_TranscodeSoA)
+    {
+        result->Transcode();
+    }
+    else if (flags & AnimationLoader_Compress)
+    {
+        result->Compress(tolerance);
+    }
+
+    clip = std::move(result);
+
+    return S_OK;
+}
+
+uint32_t AnimationClipSDKMESH::GetTrackCount() const noexcept
+{
+    assert(m_animData && m_animSize > 0);
+    return reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData)->NumFrames;
+}
+
+uint32_t AnimationClipSDKMESH::GetKeyCount() const noexcept
+{
+    assert(m_animData && m_animSize > 0);
+    return reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData)->NumAnimationKeys;
+}
+
+uint32_t AnimationClipSDKMESH::GetFramesPerSecond() const noexcept
+{
+    assert(m_animData && m_animSize > 0);
+    return reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData)->AnimationFPS;
+}
+
+uint32_t AnimationClipSDKMESH::GetTick(double time) const noexcept
+{
+    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData);
+
+    auto tick = static_cast<uint32_t>(static_cast<double>(header->AnimationFPS) * time);
+    return tick % header->NumAnimationKeys;
+}
+
+XMMATRIX XM_CALLCONV AnimationClipSDKMESH::SampleTrack(uint32_t track, uint32_t tick) const
+{
+    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData);
+    assert(track < header->NumFrames && tick < header->NumAnimationKeys);
+
+    if (IsCompressed())
+    {
+        XMVECTOR translation, quat, scale;
+        m_compressed.Decompress(track, tick, &translation, &quat, &scale);
+
+        return ComposeKeyTransform(scale, quat, translation);
+    }
+
+    auto frameData = reinterpret_cast<const SDKANIMATION_FRAME_DATA*>(m_animData + header->AnimationDataOffset);
+    return KeyToMatrix(GetTrackData(m_animData, frameData[track])[tick]);
+}
+
+_Use_decl_annotations_
+void AnimationClipSDKMESH::SampleTrack(
+    uint32_t track,
+    uint32_t tick,
+    XMVECTOR* scale,
+    XMVECTOR* rotation,
+    XMVECTOR* translation) const
+{
+    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData);
+    assert(track < header->NumFrames && tick < header->NumAnimationKeys);
+
+    if (IsCompressed())
+    {
+        m_compressed.Decompress(track, tick, translation, rotation, scale);
+        return;
+    }
+
+    // Transcoded clips keep the original keys too, so this reads them directly
+    auto frameData = reinterpret_cast<const SDKANIMATION_FRAME_DATA*>(m_animData + header->AnimationDataOffset);
+    auto data = &GetTrackData(m_animData, frameData[track])[tick];
+
+    *scale = XMLoadFloat3(&data->Scaling);
+    *rotation = LoadOrientation(*data);
+    *translation = XMLoadFloat3(&data->Translation);
+}
+
+// Quantizes every track, after which only the file header of the original data is kept
+void AnimationClipSDKMESH::Compress(float tolerance)
+{
+    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData);
+    auto frameData = reinterpret_cast<const SDKANIMATION_FRAME_DATA*>(m_animData + header->AnimationDataOffset);
+
+    const uint32_t keys = header->NumAnimationKeys;
+
+    std::vector<XMFLOAT3> translations(keys);
+    std::vector<XMFLOAT4> rotations(keys);
+    std::vector<XMFLOAT3> scales(keys);
+
+    AnimationCompressedTracks compressed;
+
+    for (size_t j = 0; j < header->NumFrames; ++j)
+    {
+        auto data = GetTrackData(m_animData, frameData[j]);
+
+        for (uint32_t k = 0; k < keys; ++k)
+        {
+            translations[k] = data[k].Translation;
+            XMStoreFloat4(&rotations[k], LoadOrientation(data[k]));
+            scales[k] = data[k].Scaling;
+        }
+
+        compressed.AddTrack(keys, translations.data(), rotations.data(), scales.data(), tolerance);
+    }
+
+    std::unique_ptr<uint8_t[]> headerOnly(new uint8_t[sizeof(SDKANIMATION_FILE_HEADER)]);
+    memcpy(headerOnly.get(), header, sizeof(SDKANIMATION_FILE_HEADER));
+
+    m_compressed = std::move(compressed);
+    m_animBlob = std::move(headerOnly);
+    m_fileView.reset();
+    m_animData = m_animBlob.get();
+    m_animSize = sizeof(SDKANIMATION_FILE_HEADER);
+}
+
+// Reorganizes the keys so each tick holds all rotations, then all translations, then all scales, with
+// the x, y, z, (w) components of 4 tracks in each vector. Quaternions are normalized here once.
+void AnimationClipSDKMESH::Transcode()
+{
+    auto header = reinterpret_cast<const SDKANIMATION_FILE_HEADER*>(m_animData);
+    auto frameData = reinterpret_cast<const SDKANIMATION_FRAME_DATA*>(m_animData + header->AnimationDataOffset);
+
+    const uint32_t groups = (header->NumFrames + 3) / 4;
+    const size_t tickStride = size_t(groups) * c_SoAVectorsPerGroup;
+
+    m_soaData.resize(tickStride * header->NumAnimationKeys);
+
+    for (uint32_t tick = 0; tick < header->NumAnimationKeys; ++tick)
+    {
+        XMVECTOR* rotations = m_soaData.data() + tickStride * tick;
+        XMVECTOR* translations = rotations + size_t(groups) * c_SoARotation;
+        XMVECTOR* scales = translations + size_t(groups) * c_SoATranslation;
+
+        for (uint32_t g = 0; g < groups; ++g)
+        {
+            XMFLOAT4A q[4];
+            XMFLOAT4A t[3];
+            XMFLOAT4A sc[3];
+
+            for (uint32_t lane = 0; lane < 4; ++lane)
+            {
+                const uint32_t track = g * 4 + lane;
+
+                // Padding lanes hold an identity transform
+                XMFLOAT4 quat(0.f, 0.f, 0.f, 1.f);
+                XMFLOAT3 trans(0.f, 0.f, 0.f);
+                XMFLOAT3 scale(1.f, 1.f, 1.f);
+
+                if (track < header->NumFrames)
+                {
+                    const auto& data = GetTrackData(m_animData, frameData[track])[tick];
+                    XMStoreFloat4(&quat, LoadOrientation(data));
+                    trans = data.Translation;
+                    scale = data.Scaling;
+                }
+
+                (&q[0].x)[lane] = quat.x;
+                (&q[1].x)[lane] = quat.y;
+                (&q[2].x)[lane] = quat.z;
+                (&q[3].x)[lane] = quat.w;
+                (&t[0].x)[lane] = trans.x;
+                (&t[1].x)[lane] = trans.y;
+                (&t[2].x)[lane] = trans.z;
+                (&sc[0].x)[lane] = scale.x;
+                (&sc[1].x)[lane] = scale.y;
+                (&sc[2].x)[lane] = scale.z;
+            }
+
+            for (size_t c = 0; c < c_SoARotation; ++c)
+            {
+                rotations[g * c_SoARotation + c] = XMLoadFloat4A(&q[c]);
+            }
+
+            for (size_t c = 0; c < c_SoATranslation; ++c)
+            {
+                translations[g * c_SoATranslation + c] = XMLoadFloat4A(&t[c]);
+                scales[g * c_SoAScale + c] = XMLoadFloat4A(&sc[c]);
+            }
+        }
+    }
+
+    m_trackGroups = groups;
+}
+
+// Computes 4 tracks per iteration, building the rotation * scale * translation matrices
+// directly from the quaternion components rather than with full matrix multiplies.
+_Use_decl_annotations_
+void AnimationClipSDKMESH::SampleTracks(uint32_t tick, XMMATRIX* trackTransforms) const
+{
+    assert(IsTranscoded());
+    assert(tick < GetKeyCount());
+
+    const size_t groups = m_trackGroups;
+    const XMVECTOR* rotations = m_soaData.data() + groups * c_SoAVectorsPerGroup * tick;
+    const XMVECTOR* translations = rotations + groups * c_SoARotation;
+    const XMVECTOR* scales = translations + groups * c_SoATranslation;
+
+    const XMVECTOR one = g_XMOne;
+    const XMVECTOR zero = XMVectorZero();
+
+    for (size_t g = 0; g < groups; ++g)
+    {
+        const XMVECTOR qx = rotations[0];
+        const XMVECTOR qy = rotations[1];
+        const XMVECTOR qz = rotations[2];
+        const XMVECTOR qw = rotations[3];
+
+        const XMVECTOR x2 = XMVectorAdd(qx, qx);
+        const XMVECTOR y2 = XMVectorAdd(qy, qy);
+        const XMVECTOR z2 = XMVectorAdd(qz, qz);
+
+        const XMVECTOR xx = XMVectorMultiply(qx, x2);
+        const XMVECTOR yy = XMVectorMultiply(qy, y2);
+        const XMVECTOR zz = XMVectorMultiply(qz, z2);
+        const XMVECTOR xy = XMVectorMultiply(qx, y2);
+        const XMVECTOR xz = XMVectorMultiply(qx, z2);
+        const XMVECTOR yz = XMVectorMultiply(qy, z2);
+        const XMVECTOR wx = XMVectorMultiply(qw, x2);
+        const XMVECTOR wy = XMVectorMultiply(qw, y2);
+        const XMVECTOR wz = XMVectorMultiply(qw, z2);
+
+        // Rotation followed by scale scales each column of the rotation matrix
+        const XMVECTOR sx = scales[0];
+        const XMVECTOR sy = scales[1];
+        const XMVECTOR sz = scales[2];
+
+        const XMVECTOR m00 = XMVectorMultiply(XMVectorSubtract(one, XMVectorAdd(yy, zz)), sx);
+        const XMVECTOR m01 = XMVectorMultiply(XMVectorAdd(xy, wz), sy);
+        const XMVECTOR m02 = XMVectorMultiply(XMVectorSubtract(xz, wy), sz);
+
+        const XMVECTOR m10 = XMVectorMultiply(XMVectorSubtract(xy, wz), sx);
+        const XMVECTOR m11 = XMVectorMultiply(XMVectorSubtract(one, XMVectorAdd(xx, zz)), sy);
+        const XMVECTOR m12 = XMVectorMultiply(XMVectorAdd(yz, wx), sz);
+
+        const XMVECTOR m20 = XMVectorMultiply(XMVectorAdd(xz, wy), sx);
+        const XMVECTOR m21 = XMVectorMultiply(XMVectorSubtract(yz, wx), sy);
+        const XMVECTOR m22 = XMVectorMultiply(XMVectorSubtract(one, XMVectorAdd(xx, yy)), sz);
+
+        // Transpose from component-major to one matrix row per track
+        const XMMATRIX row0 = XMMatrixTranspose(XMMATRIX(m00, m01, m02, zero));
+        const XMMATRIX row1 = XMMatrixTranspose(XMMATRIX(m10, m11, m12, zero));
+        const XMMATRIX row2 = XMMatrixTranspose(XMMATRIX(m20, m21, m22, zero));
+        const XMMATRIX row3 = XMMatrixTranspose(XMMATRIX(translations[0], translations[1], translations[2], one));
+
+        for (size_t lane = 0; lane < 4; ++lane)
+        {
+            XMMATRIX& m = trackTransforms[g * 4 + lane];
+            m.r[0] = row0.r[lane];
+            m.r[1] = row1.r[lane];
+            m.r[2] = row2.r[lane];
+            m.r[3] = row3.r[lane];
+        }
+
+        rotations += c_SoARotation;
+        translations += c_SoATranslation;
+        scales += c_SoAScale;
+    }
+}
+
+AnimationSDKMESH::AnimationSDKMESH() noexcept :
+    m_animTime(0.0),
+    m_skeletonModel(nullptr)
+{
+}
+
+HRESULT AnimationSDKMESH::Load(_In_z_ const wchar_t* fileName)
+{
+    Release();
+
+    return AnimationClipSDKMESH::CreateFromFile(fileName, m_clip);
+}
+
+std::shared_ptr<const AnimationClipSDKMESH::BoneToTrack> AnimationClipSDKMESH::GetBinding(const std::shared_ptr<const AnimationSkeleton>& skeleton) const
+{
+    assert(m_animData && m_animSize > 0);
+    assert(skeleton);
+
+    std::lock_guard<std::mutex> lock(m_bindingLock);
+
+    auto it = m_bindings.find(skeleton->GetId());
+    if (it != m_bindings.end())
+        return it->second.binding;
+
+    // Ids are never reused, so entries for skeletons that have been freed can't hit again
+    for (auto jt = m_bindings.begin(); jt != m_bindings.end(); )
+    {
+        if (jt->second.skeleton.expired())
+            jt = m_bindings.erase(jt);
+        else
+            ++jt;
+    }
+
+    auto binding = std::make_shared<BoneToTrack>(skeleton->GetBoneCount(), ModelBone::c_Invalid);
+
+    uint32_t track = 0;
+    for (const auto& name : m_trackNames)
+    {
+        const uint32_t bone = skeleton->FindBone(name);
+        if (bone != ModelBone::c_Invalid)
+        {
+            (*binding)[bone] = track;
+        }
+
+        ++track;
+    }
+
+    m_bindings.emplace(skeleton->GetId(), CachedBinding{ skeleton, binding });
+
+    return binding;
+}
+
+void AnimationClipSDKMESH::ClearBindingCache() const
+{
+    std::lock_guard<std::mutex> lock(m_bindingLock);
+    m_bindings.clear();
+}
+
+bool AnimationSDKMESH::Bind(const Model& model)
+{
+    auto skeleton = SkeletonForModel(model, m_skeletonModel, m_skeleton);
+    const bool any = Bind(model, std::move(skeleton));
+    m_skeletonModel = &model;
+    return any;
+}
+
+bool AnimationSDKMESH::Bind(const Model& model, std::shared_ptr<const AnimationSkeleton> skeleton)
+{
+    assert(m_clip);
+
+    if (!skeleton)
+        throw std::invalid_argument("Skeleton required");
+
+    if (model.bones.empty())
+        return false;
+
+    if (skeleton->GetBoneCount() != model.bones.size())
+        throw std::invalid_argument("Skeleton does not match model");
+
+    m_boneToTrack = m_clip->GetBinding(skeleton);
+    m_skeleton = std::move(skeleton);
+    m_skeletonModel = nullptr;
+
+    return std::any_of(m_boneToTrack->cbegin(), m_boneToTrack->cend(),
+        [](uint32_t track) { return track != ModelBone::c_Invalid; });
+}
+
+void AnimationSDKMESH::Update(float delta)
+{
+    m_animTime += static_cast<double>(delta);
+}
+
+_Use_decl_annotations_
+void AnimationSDKMESH::Apply(
+    const DirectX::Model& model,
+    size_t nbones,
+    XMMATRIX* boneTransforms,
+    const uint8_t* boneMask) const
+{
+    Apply(model, nbones, AnimationPalette_Float4x4, boneTransforms, boneMask);
+}
+
+_Use_decl_annotations_
+void AnimationSDKMESH::Apply(
+    const DirectX::Model& model,
+    size_t nbones,
+    AnimationPalette_Format format,
+    void* palette,
+    const uint8_t* boneMask) const
+{
+    assert(m_clip && m_boneToTrack && m_skeleton);
+
+    ValidatePalette(model, nbones, palette);
+
+    // Determine animation time
+    const uint32_t tick = m_clip->GetTick(m_animTime);
+
+    XMMATRIX* trackScratch = m_clip->IsTranscoded()
+        ? GetThreadScratch(Scratch_Tracks, size_t(m_clip->GetTrackGroupCount()) * 4) : nullptr;
+
+    Evaluate(model, tick, GetThreadScratch(Scratch_Absolute, model.bones.size()), trackScratch, format, palette, boneMask);
+}
+
+_Use_decl_annotations_
+size_t AnimationSDKMESH::GetSampledBoneCount(const uint8_t* boneMask) const
+{
+    assert(m_boneToTrack);
+
+    if (m_baked)
+        return 0;
+
+    const auto& boneToTrack = *m_boneToTrack;
+
+    size_t count = 0;
+    for (size_t j = 0; j < boneToTrack.size(); ++j)
+    {
+        if (boneToTrack[j] != ModelBone::c_Invalid && (!boneMask || boneMask[j]))
+            ++count;
+    }
+    return count;
+}
+
+_Use_decl_annotations_
+void AnimationSDKMESH::Evaluate(
+    const Model& model,
+    uint32_t tick,
+    XMMATRIX* absolute,
+    XMMATRIX* trackScratch,
+    AnimationPalette_Format format,
+    void* palette,
+    const uint8_t* boneMask) const
+{
+    const PaletteWriter writer = { format, palette };
+
+    if (m_baked)
+    {
+        const size_t count = model.bones.size();
+        if (m_baked->GetFormat() == format)
+        {
+            memcpy(palette, m_baked->GetPaletteData(tick), count * GetPaletteBytesPerBone(format));
+        }
+        else if (format == AnimationPalette_Float4x4)
+        {
+            m_baked->CopyPalette(tick, count, static_cast<XMMATRIX*>(palette));
+        }
+        else
+        {
+            XMMATRIX* expanded = GetThreadScratch(Scratch_Palette, count);
+            m_baked->CopyPalette(tick, count, expanded);
+
+            for (size_t j = 0; j < count; ++j)
+            {
+                writer(j, expanded[j]);
+            }
+        }
+        return;
+    }
+
+    // Compute local, absolute, and bind pose adjusted transforms in one pass
+    const auto& boneToTrack = *m_boneToTrack;
+
+    if (m_clip->IsTranscoded())
+    {
+        assert(trackScratch != nullptr);
+        m_clip->SampleTracks(tick, trackScratch);
+
+        EvaluatePose(*m_skeleton, model.invBindPoseMatrices.get(),
+            [&](uint32_t j) -> XMMATRIX
+            {
+                const uint32_t track = boneToTrack[j];
+                return (track == ModelBone::c_Invalid || (boneMask && !boneMask[j]))
+                    ? model.boneMatrices[j] : trackScratch[track];
+            },
+            absolute, writer);
+    }
+    else
+    {
+        EvaluatePose(*m_skeleton, model.invBindPoseMatrices.get(),
+            [&](uint32_t j) -> XMMATRIX
+            {
+                const uint32_t track = boneToTrack[j];
+                return (track == ModelBone::c_Invalid || (boneMask && !boneMask[j]))
+                    ? model.boneMatrices[j] : m_clip->SampleTrack(track, tick);
+            },
+            absolute, writer);
+    }
+}
+
+_Use_decl_annotations_
+void AnimationSDKMESH::ApplyBatch(
+    const Model& model,
+    size_t nbones,
+    const BatchItem* items,
+    size_t count)
+{
+    if (!count)
+        return;
+
+    if (!items)
+    {
+        throw std::invalid_argument("Batch items required");
+    }
+
+    if (nbones < model.bones.size())
+    {
+        throw std::invalid_argument("Bone transforms array is too small");
+    }
+
+    if (model.bones.empty())
+    {
+        throw std::runtime_error("Model is missing bones");
+    }
+
+    // Validate once for the whole batch, all instances must share the same clip and binding
+    const AnimationSDKMESH* first = items[0].animation;
+    if (!first || !first->m_clip || !first->m_boneToTrack || !first->m_skeleton)
+    {
+        throw std::invalid_argument("Animation instance is not bound");
+    }
+
+    const AnimationClipSDKMESH& clip = *first->m_clip;
+
+    std::vector<std::pair<uint32_t, size_t>> ticks;
+    ticks.reserve(count);
+
+    for (size_t j = 0; j < count; ++j)
+    {
+        const auto& item = items[j];
+        if (!item.animation || !item.boneTransforms)
+        {
+            throw std::invalid_argument("Batch item requires an animation instance and bone transforms array");
+        }
+
+        if (item.animation->m_clip.get() != &clip
+            || item.animation->m_boneToTrack != first->m_boneToTrack)
+        {
+            throw std::invalid_argument("Batched animation instances must share the same clip and skeleton");
+        }
+
+        ticks.emplace_back(clip.GetTick(item.time), j);
+    }
+
+    // Playback is discrete, so instances on the same tick get an identical palette which is computed once
+    std::sort(ticks.begin(), ticks.end());
+
+    XMMATRIX* absolute = GetThreadScratch(Scratch_Absolute, model.bones.size());
+    XMMATRIX* trackScratch = clip.IsTranscoded()
+        ? GetThreadScratch(Scratch_Tracks, size_t(clip.GetTrackGroupCount()) * 4) : nullptr;
+
+    const size_t paletteSize = sizeof(XMMATRIX) * model.bones.size();
+
+    for (size_t j = 0; j < ticks.size(); )
+    {
+        const uint32_t tick = ticks[j].first;
+        XMMATRIX* palette = items[ticks[j].second].boneTransforms;
+
+        first->Evaluate(model, tick, absolute, trackScratch, AnimationPalette_Float4x4, palette, nullptr);
+
+        for (++j; j < ticks.size() && ticks[j].first == tick; ++j)
+        {
+            memcpy(items[ticks[j].second].boneTransforms, palette, paletteSize);
+        }
+    }
+}
+
+_Use_decl_annotations_
+void AnimationSDKMESH::BlendLocal(
+    float weight,
+    const float* boneMask,
+    size_t nbones,
+    AnimationLocalTransform* pose,
+    float* weights) const
+{
+    assert(m_clip && m_boneToTrack);
+
+    if (weights)
+    {
+        std::fill(weights, weights + nbones, 0.f);
+    }
+
+    const uint32_t tick = m_clip->GetTick(m_animTime);
+
+    const auto& boneToTrack = *m_boneToTrack;
+    nbones = std::min(nbones, boneToTrack.size());
+
+    for (size_t j = 0; j < nbones; ++j)
+    {
+        const uint32_t track = boneToTrack[j];
+        if (track == ModelBone::c_Invalid)
+            continue;
+
+        const float w = boneMask ? weight * boneMask[j] : weight;
+        if (w <= 0.f)
+            continue;
+
+        XMVECTOR scale, rotation, translation;
+        m_clip->SampleTrack(track, tick, &scale, &rotation, &translation);
+
+        BlendLocalTransform(pose[j], scale, rotation, translation, std::min(w, 1.f));
+
+        if (weights)
+        {
+            weights[j] = std::min(w, 1.f);
+        }
+    }
+}
+
+void AnimationSDKMESH::SetBakedPalettes(std::shared_ptr<const AnimationBakedSDKMESH> baked)
+{
+    if (baked)
+    {
+        if (!m_skeleton
+            || baked->GetClip() != m_clip.get()
+            || baked->GetSkeletonId() != m_skeleton->GetId())
+        {
+            throw std::invalid_argument("Baked palettes do not match the bound clip and skeleton");
+        }
+    }
+
+    m_baked = std::move(baked);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Baked SDKMESH palettes
+//--------------------------------------------------------------------------------------
+size_t DX::GetPaletteBytesPerBone(AnimationPalette_Format format)
+{
+    switch (format)
+    {
+    case AnimationPalette_Float4x4: return sizeof(XMFLOAT4X4);
+    case AnimationPalette_Float3x4: return sizeof(XMFLOAT3X4);
+    case AnimationPalette_Half3x4: return sizeof(PackedVector::HALF) * c_HalfsPer3x4;
+    case AnimationPalette_DualQuaternion: return sizeof(XMFLOAT4) * 2;
+    default: throw std::invalid_argument("Unknown palette format");
+    }
+}
+
+AnimationBakedSDKMESH::AnimationBakedSDKMESH() noexcept :
+    m_format(AnimationPalette_Float4x4),
+    m_boneCount(0),
+    m_tickCount(0),
+    m_tickStride(0),
+    m_skeletonId(0)
+{
+}
+
+std::shared_ptr<const AnimationBakedSDKMESH> AnimationBakedSDKMESH::Create(
+    const Model& model,
+    std::shared_ptr<const AnimationClipSDKMESH> clip,
+    std::shared_ptr<const AnimationSkeleton> skeleton,
+    AnimationPalette_Format format)
+{
+    if (!clip || !skeleton)
+    {
+        throw std::invalid_argument("Clip and skeleton required");
+    }
+
+    const size_t bytesPerBone = GetPaletteBytesPerBone(format);
+
+    AnimationSDKMESH anim;
+    anim.SetClip(clip);
+    anim.Bind(model, skeleton);
+
+    std::shared_ptr<AnimationBakedSDKMESH> baked(new AnimationBakedSDKMESH);
+
+    const size_t nbones = model.bones.size();
+    const uint32_t ticks = clip->GetKeyCount();
+
+    // Each tick starts on a 16-byte boundary so 4x4 palettes can be used in place
+    const size_t tickBytes = (nbones * bytesPerBone + sizeof(XMVECTOR) - 1) & ~(sizeof(XMVECTOR) - 1);
+
+    baked->m_format = format;
+    baked->m_boneCount = nbones;
+    baked->m_tickCount = ticks;
+    baked->m_tickStride = tickBytes / sizeof(XMVECTOR);
+    baked->m_skeletonId = skeleton->GetId();
+    baked->m_data.resize(baked->m_tickStride * ticks);
+
+    XMMATRIX* absolute = GetThreadScratch(Scratch_Absolute, nbones);
+    XMMATRIX* trackScratch = clip->IsTranscoded()
+        ? GetThreadScratch(Scratch_Tracks, size_t(clip->GetTrackGroupCount()) * 4) : nullptr;
+
+    for (uint32_t tick = 0; tick < ticks; ++tick)
+    {
+        anim.Evaluate(model, tick, absolute, trackScratch, format,
+            baked->m_data.data() + baked->m_tickStride * tick, nullptr);
+    }
+
+    baked->m_clip = std::move(clip);
+
+    return baked;
+}
+
+const XMMATRIX* AnimationBakedSDKMESH::GetPalette(uint32_t tick) const
+{
+    if (m_format != AnimationPalette_Float4x4)
+    {
+        throw std::logic_error("GetPalette requires AnimationPalette_Float4x4");
+    }
+
+    return static_cast<const XMMATRIX*>(GetPaletteData(tick));
+}
+
+const void* AnimationBakedSDKMESH::GetPaletteData(uint32_t tick) const
+{
+    if (tick >= m_tickCount)
+    {
+        throw std::out_of_range("Tick out of range");
+    }
+
+    return m_data.data() + m_tickStride * tick;
+}
+
+_Use_decl_annotations_
+void AnimationBakedSDKMESH::CopyPalette(uint32_t tick, size_t nbones, XMMATRIX* boneTransforms) const
+{
+    if (!boneTransforms || nbones < m_boneCount)
+    {
+        throw std::invalid_argument("Bone transforms array is too small");
+    }
+
+    if (m_format == AnimationPalette_Float4x4)
+    {
+        memcpy(boneTransforms, GetPaletteData(tick), sizeof(XMMATRIX) * m_boneCount);
+        return;
+    }
+
+    const void* src = GetPaletteData(tick);
+
+    for (size_t j = 0; j < m_boneCount; ++j)
+    {
+        boneTransforms[j] = LoadPaletteBone(m_format, src, j);
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Streaming SDKMESH animation
+//--------------------------------------------------------------------------------------
+namespace
+{
+    // Keys for every track over a range of ticks, stored by track
+    struct StreamChunk
+    {
+        uint32_t                                firstTick;
+        uint32_t                                tickCount;
+        std::unique_ptr<SDKANIMATION_DATA[]>    keys;
+    };
+}
+
+struct AnimationStreamSDKMESH::Streamer
+{
+    ScopedHandle                hFile;
+    std::mutex                  fileLock;
+    uint32_t                    keyCount = 0;
+    uint32_t                    fps = 0;
+    uint32_t                    chunkTicks = 0;
+    uint32_t                    chunkCount = 0;
+    uint32_t                    window = 0;         // Chunks kept either side of the current chunk, plus one more ahead
+    size_t                      maxChunks = 0;
+    size_t                      chunkBytes = 0;
+    std::vector<uint64_t>       trackOffsets;       // File offset of each track's first key
+    std::vector<std::wstring>   trackNames;
+
+    std::mutex                                          lock;
+    std::condition_variable                             wake;
+    std::map<uint32_t, std::shared_ptr<const StreamChunk>> chunks;
+    std::deque<uint32_t>                                requests;
+    uint32_t                                            currentChunk = 0;
+    bool                                                shutdown = false;
+    std::atomic<uint32_t>                               stalls{ 0 };
+    std::thread                                         thread;
+
+    ~Streamer()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            shutdown = true;
+        }
+        wake.notify_all();
+
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    uint32_t GetTick(double time) const noexcept
+    {
+        auto tick = static_cast<uint32_t>(static_cast<double>(fps) * time);
+        return tick % keyCount;
+    }
+
+    // Chunks are scheduled around the playback position in both directions, since the clip loops
+    uint32_t Distance(uint32_t a, uint32_t b) const noexcept
+    {
+        const uint32_t d = (a > b) ? a - b : b - a;
+        return std::min(d, chunkCount - d);
+    }
+
+    // The extra chunk ahead means the next one is already loading when playback crosses into it, even
+    // when the budget leaves no window at all
+    bool IsWanted(uint32_t index) const noexcept
+    {
+        return Distance(index, currentChunk) <= window || index == (currentChunk + window + 1) % chunkCount;
+    }
+
+    HRESULT ReadChunk(uint32_t index, std::shared_ptr<const StreamChunk>& result)
+    {
+        auto chunk = std::make_shared<StreamChunk>();
+        chunk->firstTick = index * chunkTicks;
+        chunk->tickCount = std::min(chunkTicks, keyCount - chunk->firstTick);
+        chunk->keys.reset(new (std::nothrow) SDKANIMATION_DATA[trackOffsets.size() * chunk->tickCount]);
+        if (!chunk->keys)
+            return E_OUTOFMEMORY;
+
+        const size_t trackBytes = sizeof(SDKANIMATION_DATA) * chunk->tickCount;
+
+        std::lock_guard<std::mutex> guard(fileLock);
+
+        for (size_t j = 0; j < trackOffsets.size(); ++j)
+        {
+            HRESULT hr = ReadFileAt(hFile.get(),
+                trackOffsets[j] + sizeof(SDKANIMATION_DATA) * uint64_t(chunk->firstTick),
+                chunk->keys.get() + j * chunk->tickCount, trackBytes);
+            if (FAILED(hr))
+                return hr;
+        }
+
+        result = std::move(chunk);
+        return S_OK;
+    }
+
+    // Called with the lock held. When over budget, the chunks furthest from the playback position go first.
+    void Insert(uint32_t index, std::shared_ptr<const StreamChunk> chunk)
+    {
+        chunks[index] = std::move(chunk);
+
+        while (chunks.size() > maxChunks)
+        {
+            auto furthest = chunks.begin();
+            for (auto it = chunks.begin(); it != chunks.end(); ++it)
+            {
+                if (Distance(it->first, currentChunk) > Distance(furthest->first, currentChunk))
+                {
+                    furthest = it;
+                }
+            }
+            chunks.erase(furthest);
+        }
+    }
+
+    std::shared_ptr<const StreamChunk> GetChunk(uint32_t index)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = chunks.find(index);
+            if (it != chunks.end())
+                return it->second;
+        }
+
+        // Prefetch didn't keep up, so read it now
+        ++stalls;
+
+        std::shared_ptr<const StreamChunk> chunk;
+        HRESULT hr = ReadChunk(index, chunk);
+        if (FAILED(hr))
+            throw std::runtime_error("Failed reading animation stream");
+
+        std::lock_guard<std::mutex> guard(lock);
+        Insert(index, chunk);
+        return chunk;
+    }
+
+    void Schedule(uint32_t index)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            currentChunk = index;
+
+            for (auto it = chunks.begin(); it != chunks.end(); )
+            {
+                it = IsWanted(it->first) ? std::next(it) : chunks.erase(it);
+            }
+
+            // Ahead of the playback position is needed sooner than behind it
+            requests.clear();
+            for (uint32_t d = 0; d <= window + 1; ++d)
+            {
+                const uint32_t ahead = (index + d) % chunkCount;
+                const uint32_t behind = (index + chunkCount - (d % chunkCount)) % chunkCount;
+
+                for (const uint32_t j : { ahead, behind })
+                {
+                    if (IsWanted(j)
+                        && chunks.find(j) == chunks.end()
+                        && std::find(requests.cbegin(), requests.cend(), j) == requests.cend())
+                    {
+                        requests.push_back(j);
+                    }
+                }
+            }
+        }
+        wake.notify_one();
+    }
+
+    void Worker()
+    {
+        for (;;)
+        {
+            uint32_t index = 0;
+
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return shutdown || !requests.empty(); });
+
+                if (shutdown)
+                    return;
+
+                index = requests.front();
+                requests.pop_front();
+
+                if (chunks.find(index) != chunks.end())
+                    continue;
+            }
+
+            std::shared_ptr<const StreamChunk> chunk;
+            if (FAILED(ReadChunk(index, chunk)))
+                continue;
+
+            std::lock_guard<std::mutex> guard(lock);
+            if (IsWanted(index) && chunks.find(index) == chunks.end())
+            {
+                Insert(index, std::move(chunk));
+            }
+        }
+    }
+};
+
+AnimationStreamSDKMESH::AnimationStreamSDKMESH() noexcept :
+    m_animTime(0.0),
+    m_skeletonModel(nullptr)
+{
+}
+
+AnimationStreamSDKMESH::~AnimationStreamSDKMESH() = default;
+
+AnimationStreamSDKMESH::AnimationStreamSDKMESH(AnimationStreamSDKMESH&&) noexcept = default;
+AnimationStreamSDKMESH& AnimationStreamSDKMESH::operator= (AnimationStreamSDKMESH&&) noexcept = default;
+
+_Use_decl_annotations_
+HRESULT AnimationStreamSDKMESH::Load(const wchar_t* fileName, float windowSeconds, size_t memoryBudget)
+{
+    Release();
+
+    if (!fileName || !(windowSeconds > 0.f))
+        return E_INVALIDARG;
+
+    std::unique_ptr<Streamer> streamer(new (std::nothrow) Streamer);
+    if (!streamer)
+        return E_OUTOFMEMORY;
+
+    streamer->hFile = OpenFileForRead(fileName);
+    if (!streamer->hFile)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    LARGE_INTEGER fileSize = {};
+    if (!GetFileSizeEx(streamer->hFile.get(), &fileSize))
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    const auto len = static_cast<uint64_t>(fileSize.QuadPart);
+    if (len < sizeof(SDKANIMATION_FILE_HEADER))
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+    // Only the header and frame table are read up front, validated as for AnimationClipSDKMESH
+    SDKANIMATION_FILE_HEADER header = {};
+    HRESULT hr = ReadFileAt(streamer->hFile.get(), 0, &header, sizeof(header));
+    if (FAILED(hr))
+        return hr;
+
+    if (header.Version != SDKMESH_FILE_VERSION
+        || header.IsBigEndian != 0
+        || header.FrameTransformType != 0 /*FTT_RELATIVE*/
+        || header.NumAnimationKeys == 0
+        || header.NumFrames == 0
+        || header.AnimationFPS == 0)
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+    if (header.AnimationDataOffset > len
+        || header.AnimationDataSize > len - header.AnimationDataOffset)
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+    const uint64_t keyBytes = sizeof(SDKANIMATION_DATA) * uint64_t(header.NumAnimationKeys);
+
+    if (sizeof(SDKANIMATION_FRAME_DATA) * uint64_t(header.NumFrames) > len - header.AnimationDataOffset)
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+    std::vector<SDKANIMATION_FRAME_DATA> frameData(header.NumFrames);
+    hr = ReadFileAt(streamer->hFile.get(), header.AnimationDataOffset,
+        frameData.data(), sizeof(SDKANIMATION_FRAME_DATA) * frameData.size());
+    if (FAILED(hr))
+        return hr;
+
+    streamer->trackOffsets.reserve(header.NumFrames);
+    streamer->trackNames.reserve(header.NumFrames);
+
+    for (const auto& frame : frameData)
+    {
+        const uint64_t offset = sizeof(SDKANIMATION_FILE_HEADER) + frame.DataOffset;
+        if (keyBytes > len || frame.DataOffset > len || offset > len - keyBytes)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+        streamer->trackOffsets.push_back(offset);
+
+        wchar_t frameName[MAX_FRAME_NAME] = {};
+        MultiByteToWideChar(CP_UTF8, 0, frame.FrameName, -1, frameName, MAX_FRAME_NAME);
+        frameName[MAX_FRAME_NAME - 1] = 0;
+
+        streamer->trackNames.emplace_back(AnimationSkeleton::FoldName(frameName));
+    }
+
+    // Quarter second chunks keep the number of reads per chunk reasonable without wasting the budget
+    streamer->keyCount = header.NumAnimationKeys;
+    streamer->fps = header.AnimationFPS;
+    streamer->chunkTicks = std::max(1u, header.AnimationFPS / 4);
+    streamer->chunkCount = (header.NumAnimationKeys + streamer->chunkTicks - 1) / streamer->chunkTicks;
+    streamer->chunkBytes = sizeof(SDKANIMATION_DATA) * size_t(streamer->chunkTicks) * header.NumFrames;
+
+    auto window = static_cast<uint32_t>(std::ceil(double(windowSeconds) * header.AnimationFPS / streamer->chunkTicks));
+    window = std::min(window, streamer->chunkCount / 2);
+
+    // The window either side of the current chunk, plus one chunk ahead being prefetched
+    size_t maxChunks = size_t(window) * 2 + 2;
+    if (memoryBudget > 0)
+    {
+        // The current chunk and the one being prefetched are the minimum for playback without stalls
+        const size_t budgetChunks = memoryBudget / streamer->chunkBytes;
+        if (budgetChunks < 2)
+            return E_INVALIDARG;
+
+        if (budgetChunks < maxChunks)
+        {
+            maxChunks = budgetChunks;
+            window = static_cast<uint32_t>((budgetChunks - 2) / 2);
+        }
+    }
+
+    streamer->window = window;
+    streamer->maxChunks = maxChunks;
+
+    streamer->thread = std::thread(&Streamer::Worker, streamer.get());
+
+    m_streamer = std::move(streamer);
+    m_streamer->Schedule(0);
+
+    return S_OK;
+}
+
+void AnimationStreamSDKMESH::Release()
+{
+    m_animTime = 0.0;
+    m_streamer.reset();
+    m_skeleton.reset();
+    m_skeletonModel = nullptr;
+    m_boneToTrack.clear();
+}
+
+bool AnimationStreamSDKMESH::Bind(const Model& model)
+{
+    auto skeleton = SkeletonForModel(model, m_skeletonModel, m_skeleton);
+    const bool any = Bind(model, std::move(skeleton));
+    m_skeletonModel = &model;
+    return any;
+}
+
+bool AnimationStreamSDKMESH::Bind(const Model& model, std::shared_ptr<const AnimationSkeleton> skeleton)
+{
+    assert(m_streamer);
+
+    if (!skeleton)
+        throw std::invalid_argument("Skeleton required");
+
+    if (model.bones.empty())
+        return false;
+
+    if (skeleton->GetBoneCount() != model.bones.size())
+        throw std::invalid_argument("Skeleton does not match model");
+
+    m_boneToTrack.assign(skeleton->GetBoneCount(), ModelBone::c_Invalid);
+
+    bool any = false;
+    uint32_t track = 0;
+    for (const auto& name : m_streamer->trackNames)
+    {
+        const uint32_t bone = skeleton->FindBone(name);
+        if (bone != ModelBone::c_Invalid)
+        {
+            m_boneToTrack[bone] = track;
+            any = true;
+        }
+
+        ++track;
+    }
+
+    m_skeleton = std::move(skeleton);
+    m_skeletonModel = nullptr;
+
+    return any;
+}
+
+void AnimationStreamSDKMESH::Update(float delta)
+{
+    Seek(m_animTime + static_cast<double>(delta));
+}
+
+void AnimationStreamSDKMESH::Seek(double time)
+{
+    assert(m_streamer);
+
+    const uint32_t chunk = m_streamer->GetTick(m_animTime) / m_streamer->chunkTicks;
+    m_animTime = time;
+
+    const uint32_t next = m_streamer->GetTick(m_animTime) / m_streamer->chunkTicks;
+    if (next != chunk)
+    {
+        m_streamer->Schedule(next);
+    }
+}
+
+_Use_decl_annotations_
+void AnimationStreamSDKMESH::Apply(
+    const Model& model,
+    size_t nbones,
+    XMMATRIX* boneTransforms) const
+{
+    assert(m_streamer && m_skeleton);
+
+    ValidatePalette(model, nbones, boneTransforms);
+
+    const uint32_t tick = m_streamer->GetTick(m_animTime);
+
+    // Holding a reference keeps the chunk alive even if the worker evicts it meanwhile
+    const auto chunk = m_streamer->GetChunk(tick / m_streamer->chunkTicks);
+    const uint32_t key = tick - chunk->firstTick;
+
+    EvaluatePose(*m_skeleton, model.invBindPoseMatrices.get(),
+        [&](uint32_t j) -> XMMATRIX
+        {
+            const uint32_t track = m_boneToTrack[j];
+            return (track == ModelBone::c_Invalid)
+                ? model.boneMatrices[j] : KeyToMatrix(chunk->keys[size_t(track) * chunk->tickCount + key]);
+        },
+        GetThreadScratch(Scratch_Absolute, model.bones.size()), PaletteWriter{ AnimationPalette_Float4x4, boneTransforms });
+}
+
+uint32_t AnimationStreamSDKMESH::GetTrackCount() const noexcept
+{
+    return m_streamer ? static_cast<uint32_t>(m_streamer->trackOffsets.size()) : 0;
+}
+
+uint32_t AnimationStreamSDKMESH::GetKeyCount() const noexcept
+{
+    return m_streamer ? m_streamer->keyCount : 0;
+}
+
+uint32_t AnimationStreamSDKMESH::GetFramesPerSecond() const noexcept
+{
+    return m_streamer ? m_streamer->fps : 0;
+}
+
+size_t AnimationStreamSDKMESH::GetResidentBytes() const noexcept
+{
+    if (!m_streamer)
+        return 0;
+
+    std::lock_guard<std::mutex> guard(m_streamer->lock);
+    return m_streamer->chunks.size() * m_streamer->chunkBytes;
+}
+
+uint32_t AnimationStreamSDKMESH::GetStallCount() const noexcept
+{
+    return m_streamer ? m_streamer->stalls.load() : 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Visual Studio Starter Kit CMO animation
+//--------------------------------------------------------------------------------------
+namespace
+{
+#pragma pack(push,1)
+
+    struct Clip
+    {
+        float StartTime;
+        float EndTime;
+        uint32_t keys;
+    };
+
+    static_assert(sizeof(Clip) == 12, "CMO Mesh structure size incorrect");
+
+    struct Keyframe
+    {
+        uint32_t BoneIndex;
+        float Time;
+        DirectX::XMFLOAT4X4 Transform;
+    };
+
+    static_assert(sizeof(Keyframe) == 72, "CMO Mesh structure size incorrect");
+
+#pragma pack(pop)
+
+    constexpr uint32_t c_MaxBones = 0xFFFF;
+
+    struct ClipSource
+    {
+        std::wstring        name;
+        const Clip*         clip;
+        const Keyframe*     keys;
+        uint32_t            boneCount;
+    };
+}
+
+AnimationLibraryCMO::AnimationLibraryCMO() noexcept :
+    m_transforms(nullptr),
+    m_keyTimes(nullptr),
+    m_boneKeys(nullptr),
+    m_keyCount(0),
+    m_boneCount(0),
+    m_interpolate(false)
+{
+}
+
+_Use_decl_annotations_
+HRESULT AnimationLibraryCMO::CreateFromFile(
+    const wchar_t* fileName,
+    size_t offset,
+    std::shared_ptr<const AnimationLibraryCMO>& library,
+    uint32_t flags,
+    float tolerance)
+{
+    return Create(fileName, offset, nullptr, false, flags, tolerance, library);
+}
+
+// Parses the animation section once. When onlyOne is set, just the first clip matching clipName
+// (or the first clip if there is no name) is kept.
+_Use_decl_annotations_
+HRESULT AnimationLibraryCMO::Create(
+    const wchar_t* fileName,
+    size_t offset,
+    const wchar_t* clipName,
+    bool onlyOne,
+    uint32_t flags,
+    float tolerance,
+    std::shared_ptr<const AnimationLibraryCMO>& library)
+{
+    library.reset();
+
+    if (!fileName || !offset)
+        return E_INVALIDARG;
+
+    if ((flags & AnimationLoader_Compress) && !(tolerance > 0.f))
+        return E_INVALIDARG;
+
+    // Keys are regrouped into the library, so a mapped file is released once it is built
+    FileData file;
+    HRESULT hr = LoadFileData(fileName, offset, flags, file);
+    if (FAILED(hr))
+        return hr;
+
+    const uint8_t* blob = file.data;
+    const size_t dataSize = file.size;
+    if (dataSize < sizeof(uint32_t))
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+    auto nClips = reinterpret_cast<const uint32_t*>(blob);
+    size_t usedSize = sizeof(uint32_t);
+
+    // First pass validates the section and sizes the key data
+    std::vector<ClipSource> sources;
+    size_t totalKeys = 0;
+    size_t totalBones = 0;
+
+    for (size_t j = 0; j < *nClips; ++j)
+    {
+        // Clip name
+        auto nName = reinterpret_cast<const uint32_t*>(blob + usedSize);
+        usedSize += sizeof(uint32_t);
+        if (dataSize < usedSize)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+        auto name = reinterpret_cast<const wchar_t*>(blob + usedSize);
+
+        usedSize += sizeof(wchar_t) * (*nName);
+        if (dataSize < usedSize)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+        auto clip = reinterpret_cast<const Clip*>(blob + usedSize);
+        usedSize += sizeof(Clip);
+        if (dataSize < usedSize)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+        if (!clip->keys)
+            return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+        auto keys = reinterpret_cast<const Keyframe*>(blob + usedSize);
+        usedSize += sizeof(Keyframe) * clip->keys;
+        if (dataSize < usedSize)
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+        std::wstring clipString(name, wcsnlen(name, *nName));
+
+        if (onlyOne && clipName && _wcsicmp(clipName, clipString.c_str()) != 0)
+            continue;
+
+        uint32_t maxBone = 0;
+        for (uint32_t k = 0; k < clip->keys; ++k)
+        {
+            if (keys[k].BoneIndex >= c_MaxBones)
+                return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+            maxBone = std::max(maxBone, keys[k].BoneIndex);
+        }
+
+        sources.emplace_back(ClipSource{ std::move(clipString), clip, keys, maxBone + 1 });
+        totalKeys += clip->keys;
+        totalBones += size_t(maxBone) + 1;
+
+        if (onlyOne)
+            break;
+    }
+
+    if (sources.empty())
+        return E_FAIL;
+
+    if (totalKeys > UINT32_MAX || totalBones > UINT32_MAX)
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+    std::shared_ptr<AnimationLibraryCMO> result(new (std::nothrow) AnimationLibraryCMO);
+    if (!result)
+        return E_OUTOFMEMORY;
+
+    result->Allocate(totalKeys, totalBones, true);
+    result->m_interpolate = (flags & AnimationLoader_InterpolateKeys) != 0;
+    result->m_clips.reserve(sources.size());
+
+    // Second pass regroups each clip's keys by bone, keeping file order for keys with the same time
+    uint32_t firstKey = 0;
+    uint32_t firstBone = 0;
+    std::vector<uint32_t> order;
+
+    for (auto& source : sources)
+    {
+        const Clip* clip = source.clip;
+        const Keyframe* keys = source.keys;
+
+        order.resize(clip->keys);
+        for (uint32_t k = 0; k < clip->keys; ++k)
+        {
+            order[k] = k;
+        }
+
+        std::stable_sort(order.begin(), order.end(), [keys](uint32_t a, uint32_t b)
             {
-                break;
+                if (keys[a].BoneIndex != keys[b].BoneIndex)
+                    return keys[a].BoneIndex < keys[b].BoneIndex;
+
+                return keys[a].Time < keys[b].Time;
+            });
+
+        BoneKeys* boneKeys = result->m_boneKeys + firstBone;
+        std::fill(boneKeys, boneKeys + source.boneCount, BoneKeys{ 0, 0 });
+
+        for (uint32_t k = 0; k < clip->keys; ++k)
+        {
+            const auto& key = keys[order[k]];
+            const uint32_t index = firstKey + k;
+
+            auto& bone = boneKeys[key.BoneIndex];
+            if (!bone.keyCount)
+            {
+                bone.firstKey = index;
+            }
+            ++bone.keyCount;
+
+            result->m_keyTimes[index] = key.Time;
+            result->m_transforms[index] = XMLoadFloat4x4(&key.Transform);
+        }
+
+        const auto index = static_cast<uint32_t>(result->m_clips.size());
+        result->m_clipNames.emplace(AnimationSkeleton::FoldName(source.name.c_str()), index);
+        result->m_clips.emplace_back(ClipInfo{ std::move(source.name), clip->StartTime, clip->EndTime, firstBone, source.boneCount });
+
+        firstKey += clip->keys;
+        firstBone += source.boneCount;
+    }
+
+    if (flags & AnimationLoader_Compress)
+    {
+        std::ignore = result->Compress(tolerance);
+    }
+
+    library = std::move(result);
+
+    return S_OK;
+}
+
+// Key matrices, key times, and bone key ranges for every clip share a single allocation
+void AnimationLibraryCMO::Allocate(size_t keyCount, size_t boneCount, bool transforms)
+{
+    const size_t matrixBytes = (transforms) ? sizeof(XMMATRIX) * keyCount : 0;
+    const size_t bytes = matrixBytes + sizeof(float) * keyCount + sizeof(BoneKeys) * boneCount;
+
+    m_data = ModelBone::MakeArray((bytes + sizeof(XMMATRIX) - 1) / sizeof(XMMATRIX));
+
+    auto ptr = reinterpret_cast<uint8_t*>(m_data.get());
+    m_transforms = (transforms) ? reinterpret_cast<XMMATRIX*>(ptr) : nullptr;
+    m_keyTimes = reinterpret_cast<float*>(ptr + matrixBytes);
+    m_boneKeys = reinterpret_cast<BoneKeys*>(ptr + matrixBytes + sizeof(float) * keyCount);
+    m_keyCount = keyCount;
+    m_boneCount = boneCount;
+}
+
+_Use_decl_annotations_
+uint32_t AnimationLibraryCMO::FindClip(const wchar_t* name) const
+{
+    if (!name)
+        return c_InvalidClip;
+
+    auto it = m_clipNames.find(AnimationSkeleton::FoldName(name));
+    return (it != m_clipNames.end()) ? it->second : c_InvalidClip;
+}
+
+void AnimationLibraryCMO::GetKeyTimes(uint32_t clip, std::vector<float>& times) const
+{
+    if (clip >= m_clips.size())
+        throw std::invalid_argument("Invalid clip");
+
+    const auto& info = m_clips[clip];
+
+    times.clear();
+    for (uint32_t j = 0; j < info.boneCount; ++j)
+    {
+        const auto& bone = m_boneKeys[info.firstBone + j];
+        times.insert(times.end(), m_keyTimes + bone.firstKey, m_keyTimes + bone.firstKey + bone.keyCount);
+    }
+
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
+}
+
+// Decomposes every key into scale, rotation, and translation for quantization. If any key can't be
+// rebuilt within the tolerance the matrices are kept instead.
+bool AnimationLibraryCMO::Compress(float tolerance)
+{
+    const XMVECTOR epsilon = XMVectorReplicate(tolerance);
+
+    std::vector<XMFLOAT3> translations;
+    std::vector<XMFLOAT4> rotations;
+    std::vector<XMFLOAT3> scales;
+
+    AnimationCompressedTracks compressed;
+
+    // Compressed tracks are indexed the same way as the bone key ranges
+    for (size_t j = 0; j < m_boneCount; ++j)
+    {
+        const auto& bone = m_boneKeys[j];
+
+        translations.resize(bone.keyCount);
+        rotations.resize(bone.keyCount);
+        scales.resize(bone.keyCount);
+
+        for (uint32_t k = 0; k < bone.keyCount; ++k)
+        {
+            const XMMATRIX m = m_transforms[bone.firstKey + k];
+
+            XMVECTOR scale, quat, translation;
+            if (!XMMatrixDecompose(&scale, &quat, &translation, m))
+                return false;
+
+            quat = XMQuaternionNormalize(quat);
+
+            const XMMATRIX check = ComposeLocalTransform(scale, quat, translation);
+
+            for (size_t r = 0; r < 4; ++r)
+            {
+                if (!XMVector4NearEqual(check.r[r], m.r[r], epsilon))
+                    return false;
             }
 
-            m_animBones[kit.first] = m_transforms[k];
-            ++k;
+            XMStoreFloat3(&translations[k], translation);
+            XMStoreFloat4(&rotations[k], quat);
+            XMStoreFloat3(&scales[k], scale);
+        }
+
+        compressed.AddTrack(bone.keyCount, translations.data(), rotations.data(), scales.data(), tolerance);
+    }
+
+    // Repack without the matrices
+    ModelBone::TransformArray data;
+    std::swap(data, m_data);
+
+    const float* keyTimes = m_keyTimes;
+    const BoneKeys* boneKeys = m_boneKeys;
+
+    Allocate(m_keyCount, m_boneCount, false);
+    memcpy(m_keyTimes, keyTimes, sizeof(float) * m_keyCount);
+    memcpy(m_boneKeys, boneKeys, sizeof(BoneKeys) * m_boneCount);
+
+    m_compressed = std::move(compressed);
+
+    return true;
+}
+
+AnimationCMO::AnimationCMO() noexcept :
+    m_animTime(0.f),
+    m_startTime(0.f),
+    m_endTime(0.f),
+    m_boneKeys(nullptr),
+    m_boneCount(0),
+    m_firstTrack(0),
+    m_skeletonModel(nullptr)
+{
+}
+
+_Use_decl_annotations_
+HRESULT AnimationCMO::Load(const wchar_t* fileName, size_t offset, const wchar_t* clipName, uint32_t flags, float tolerance)
+{
+    std::shared_ptr<const AnimationLibraryCMO> library;
+    HRESULT hr = AnimationLibraryCMO::Create(fileName, offset, clipName, true, flags, tolerance, library);
+    if (FAILED(hr))
+        return hr;
+
+    SetClip(std::move(library), 0);
+
+    return S_OK;
+}
+
+void AnimationCMO::SetClip(std::shared_ptr<const AnimationLibraryCMO> library, uint32_t clip)
+{
+    if (!library || clip >= library->GetClipCount())
+        throw std::invalid_argument("Invalid clip");
+
+    // The skeleton only depends on the model, so keep it for the next Bind(model)
+    auto skeleton = std::move(m_skeleton);
+    const Model* skeletonModel = m_skeletonModel;
+
+    Release();
+
+    m_skeleton = std::move(skeleton);
+    m_skeletonModel = skeletonModel;
+
+    const auto& info = library->m_clips[clip];
+
+    m_startTime = info.startTime;
+    m_endTime = info.endTime;
+    m_boneKeys = library->m_boneKeys + info.firstBone;
+    m_boneCount = info.boneCount;
+    m_firstTrack = info.firstBone;
+    m_library = std::move(library);
+
+    m_cursors.assign(m_boneCount, 0);
+    UpdateCursors();
+}
+
+void AnimationCMO::Bind(const Model& model)
+{
+    auto skeleton = SkeletonForModel(model, m_skeletonModel, m_skeleton);
+    Bind(model, std::move(skeleton));
+    m_skeletonModel = &model;
+}
+
+void AnimationCMO::Bind(const Model& model, std::shared_ptr<const AnimationSkeleton> skeleton)
+{
+    assert(m_library);
+
+    if (!skeleton)
+        throw std::invalid_argument("Skeleton required");
+
+    if (skeleton->GetBoneCount() != model.bones.size())
+        throw std::invalid_argument("Skeleton does not match model");
+
+    m_skeleton = std::move(skeleton);
+    m_skeletonModel = nullptr;
+}
+
+void AnimationCMO::Update(float delta)
+{
+    m_animTime += delta;
+    if (m_animTime > m_endTime)
+    {
+        m_animTime -= m_endTime;
+    }
+
+    // Cursors are advanced here rather than in Apply so that Apply never modifies the instance
+    UpdateCursors();
+}
+
+void AnimationCMO::Seek(float time)
+{
+    if (m_endTime > 0.f)
+    {
+        time = fmodf(time, m_endTime);
+        if (time < 0.f)
+        {
+            time += m_endTime;
+        }
+    }
+
+    m_animTime = time;
+
+    // Re-seat every cursor now rather than walking from the old position
+    for (size_t j = 0; j < m_boneCount; ++j)
+    {
+        const auto& bone = m_boneKeys[j];
+        auto first = m_library->m_keyTimes + bone.firstKey;
+        auto it = std::upper_bound(first, first + bone.keyCount, m_animTime);
+        m_cursors[j] = static_cast<uint32_t>(it - first);
+    }
+}
+
+// Each cursor is the number of keys for that bone at or before the current time
+void AnimationCMO::UpdateCursors()
+{
+    for (size_t j = 0; j < m_boneCount; ++j)
+    {
+        const auto& bone = m_boneKeys[j];
+        if (!bone.keyCount)
+            continue;
+
+        const float* times = m_library->m_keyTimes + bone.firstKey;
+        uint32_t cursor = m_cursors[j];
+
+        if (cursor > 0 && times[cursor - 1] > m_animTime)
+        {
+            // Time moved backwards (looping or scrubbing), so search from the start
+            cursor = static_cast<uint32_t>(std::upper_bound(times, times + cursor, m_animTime) - times);
+        }
+        else
+        {
+            // Playing forward normally only advances by a key or two per frame
+            while (cursor < bone.keyCount && times[cursor] <= m_animTime)
+            {
+                ++cursor;
+            }
         }
+
+        m_cursors[j] = cursor;
+    }
+}
+
+_Use_decl_annotations_
+void AnimationCMO::Apply(
+    const Model& model,
+    size_t nbones,
+    XMMATRIX* boneTransforms,
+    const uint8_t* boneMask) const
+{
+    Apply(model, nbones, AnimationPalette_Float4x4, boneTransforms, boneMask);
+}
+
+_Use_decl_annotations_
+void AnimationCMO::Apply(
+    const Model& model,
+    size_t nbones,
+    AnimationPalette_Format format,
+    void* palette,
+    const uint8_t* boneMask) const
+{
+    assert(m_library && m_skeleton);
+
+    ValidatePalette(model, nbones, palette);
+
+    const bool animated = (m_animTime >= m_startTime);
+
+    // Compute local, absolute, and bind pose adjusted transforms in one pass
+    EvaluatePose(*m_skeleton, model.invBindPoseMatrices.get(),
+        [&](uint32_t j) -> XMMATRIX
+        {
+            if (animated && j < m_boneCount && (!boneMask || boneMask[j]))
+            {
+                const uint32_t cursor = m_cursors[j];
+                if (cursor > 0)
+                {
+                    return SampleBone(j, cursor);
+                }
+            }
+
+            return model.boneMatrices[j];
+        },
+        GetThreadScratch(Scratch_Absolute, model.bones.size()), PaletteWriter{ format, palette });
+}
+
+_Use_decl_annotations_
+size_t AnimationCMO::GetSampledBoneCount(const uint8_t* boneMask) const
+{
+    assert(m_library && m_skeleton);
+
+    if (m_animTime < m_startTime)
+        return 0;
+
+    const size_t nbones = std::min<size_t>(m_boneCount, m_skeleton->GetBoneCount());
+
+    size_t count = 0;
+    for (size_t j = 0; j < nbones; ++j)
+    {
+        if (m_cursors[j] > 0 && (!boneMask || boneMask[j]))
+            ++count;
+    }
+    return count;
+}
+
+_Use_decl_annotations_
+void AnimationCMO::BlendLocal(
+    float weight,
+    const float* boneMask,
+    size_t nbones,
+    AnimationLocalTransform* pose,
+    float* weights) const
+{
+    assert(m_library);
+
+    if (weights)
+    {
+        std::fill(weights, weights + nbones, 0.f);
     }
 
-    // Compute absolute locations
-    model.CopyAbsoluteBoneTransforms(nbones, m_animBones.get(), boneTransforms);
+    if (m_animTime < m_startTime)
+        return;
+
+    nbones = std::min<size_t>(nbones, m_boneCount);
 
-    // Adjust for model's bind pose.
     for (size_t j = 0; j < nbones; ++j)
     {
-        boneTransforms[j] = XMMatrixMultiply(model.invBindPoseMatrices[j], boneTransforms[j]);
+        const uint32_t cursor = m_cursors[j];
+        if (!cursor)
+            continue;
+
+        const float w = boneMask ? weight * boneMask[j] : weight;
+        if (w <= 0.f)
+            continue;
+
+        XMVECTOR scale, rotation, translation;
+        SampleBone(static_cast<uint32_t>(j), cursor, &scale, &rotation, &translation);
+
+        BlendLocalTransform(pose[j], scale, rotation, translation, std::min(w, 1.f));
+
+        if (weights)
+        {
+            weights[j] = std::min(w, 1.f);
+        }
+    }
+}
+
+// Returns the key before the cursor, or when interpolating the blend between it and the next key
+XMMATRIX XM_CALLCONV AnimationCMO::SampleBone(uint32_t bone, uint32_t cursor) const
+{
+    const AnimationLibraryCMO& library = *m_library;
+    const auto& keys = m_boneKeys[bone];
+
+    if (library.m_transforms && (!library.m_interpolate || cursor >= keys.keyCount))
+    {
+        return library.m_transforms[keys.firstKey + cursor - 1];
+    }
+
+    XMVECTOR scale, rotation, translation;
+    SampleBone(bone, cursor, &scale, &rotation, &translation);
+
+    return ComposeLocalTransform(scale, rotation, translation);
+}
+
+// As above as separate components. Scale and translation are lerped and rotation slerped, which
+// animreduce relies on when dropping keys.
+_Use_decl_annotations_
+void AnimationCMO::SampleBone(
+    uint32_t bone,
+    uint32_t cursor,
+    XMVECTOR* scale,
+    XMVECTOR* rotation,
+    XMVECTOR* translation) const
+{
+    const AnimationLibraryCMO& library = *m_library;
+    const auto& keys = m_boneKeys[bone];
+    const uint32_t key = keys.firstKey + cursor - 1;
+    const uint32_t track = m_firstTrack + bone;
+
+    auto loadKey = [&](uint32_t index, XMVECTOR* s, XMVECTOR* r, XMVECTOR* t)
+        {
+            if (!library.m_transforms)
+            {
+                library.m_compressed.Decompress(track, index, t, r, s);
+            }
+            else if (!XMMatrixDecompose(s, r, t, library.m_transforms[keys.firstKey + index]))
+            {
+                // Keys with shear or zero scale keep just their translation
+                *s = g_XMOne;
+                *r = XMQuaternionIdentity();
+                *t = library.m_transforms[keys.firstKey + index].r[3];
+            }
+        };
+
+    loadKey(cursor - 1, scale, rotation, translation);
+
+    if (!library.m_interpolate || cursor >= keys.keyCount)
+        return;
+
+    XMVECTOR scale1, quat1, translation1;
+    loadKey(cursor, &scale1, &quat1, &translation1);
+
+    const float time0 = library.m_keyTimes[key];
+    const float time1 = library.m_keyTimes[key + 1];
+    const float t = (time1 > time0) ? std::min((m_animTime - time0) / (time1 - time0), 1.f) : 0.f;
+
+    *scale = XMVectorLerp(*scale, scale1, t);
+    *rotation = XMQuaternionSlerp(*rotation, quat1, t);
+    *translation = XMVectorLerp(*translation, translation1, t);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Blending
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void AnimationBlend::Apply(
+    const Model& model,
+    const Layer* layers,
+    size_t count,
+    size_t nbones,
+    XMMATRIX* boneTransforms)
+{
+    Apply(model, layers, count, nbones, AnimationPalette_Float4x4, boneTransforms);
+}
+
+_Use_decl_annotations_
+void AnimationBlend::Apply(
+    const Model& model,
+    const Layer* layers,
+    size_t count,
+    size_t nbones,
+    AnimationPalette_Format format,
+    void* palette)
+{
+    if (!count || !layers)
+    {
+        throw std::invalid_argument("Blend layers required");
+    }
+
+    ValidatePalette(model, nbones, palette);
+
+    const AnimationSkeleton* skeleton = nullptr;
+
+    for (size_t j = 0; j < count; ++j)
+    {
+        const auto& layer = layers[j];
+        if ((layer.sdkmesh != nullptr) == (layer.cmo != nullptr))
+        {
+            throw std::invalid_argument("Blend layer requires exactly one animation instance");
+        }
+
+        const auto& layerSkeleton = layer.sdkmesh ? layer.sdkmesh->GetSkeleton() : layer.cmo->GetSkeleton();
+        if (!layerSkeleton || layerSkeleton->GetBoneCount() != model.bones.size())
+        {
+            throw std::invalid_argument("Blend layer is not bound to this model");
+        }
+
+        if (!skeleton)
+        {
+            skeleton = layerSkeleton.get();
+        }
+    }
+
+    const size_t boneCount = model.bones.size();
+
+    thread_local std::vector<AnimationLocalTransform> s_pose;
+    s_pose.assign(skeleton->GetBindPose(), skeleton->GetBindPose() + boneCount);
+
+    // Share of each bone's final pose from SDKMESH and CMO layers, which compose keys in different orders
+    thread_local std::vector<float> s_weights;
+    thread_local std::vector<float> s_sdkmeshShare;
+    thread_local std::vector<float> s_cmoShare;
+    s_weights.resize(boneCount);
+    s_sdkmeshShare.assign(boneCount, 0.f);
+    s_cmoShare.assign(boneCount, 0.f);
+
+    AnimationLocalTransform* pose = s_pose.data();
+
+    for (size_t j = 0; j < count; ++j)
+    {
+        const auto& layer = layers[j];
+        if (layer.weight <= 0.f)
+            continue;
+
+        if (layer.sdkmesh)
+        {
+            layer.sdkmesh->BlendLocal(layer.weight, layer.boneMask, boneCount, pose, s_weights.data());
+        }
+        else
+        {
+            layer.cmo->BlendLocal(layer.weight, layer.boneMask, boneCount, pose, s_weights.data());
+        }
+
+        auto& share = layer.sdkmesh ? s_sdkmeshShare : s_cmoShare;
+        for (size_t k = 0; k < boneCount; ++k)
+        {
+            const float w = s_weights[k];
+            if (w > 0.f)
+            {
+                s_sdkmeshShare[k] *= 1.f - w;
+                s_cmoShare[k] *= 1.f - w;
+                share[k] += w;
+            }
+        }
     }
+
+    // The hierarchy and bind pose are only evaluated for the final blended pose
+    EvaluatePose(*skeleton, model.invBindPoseMatrices.get(),
+        [&](uint32_t j) -> XMMATRIX
+        {
+            if (s_sdkmeshShare[j] <= 0.f && s_cmoShare[j] <= 0.f)
+                return model.boneMatrices[j];
+
+            if (s_sdkmeshShare[j] > s_cmoShare[j])
+                return ComposeKeyTransform(pose[j].scale, pose[j].rotation, pose[j].translation);
+
+            return ComposeLocalTransform(pose[j].scale, pose[j].rotation, pose[j].translation);
+        },
+        GetThreadScratch(Scratch_Absolute, boneCount), PaletteWriter{ format, palette });
 }
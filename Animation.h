@@ -8,16 +8,203 @@
 //--------------------------------------------------------------------------------------
 #pragma once
 
+#include "AnimationCore.h"
+
 #include <DirectXMath.h>
 #include <Model.h>
 
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 
 namespace DX
 {
+    enum AnimationLoader_Flags : uint32_t
+    {
+        AnimationLoader_Default = 0x0,
+        AnimationLoader_TranscodeSoA = 0x1,
+        AnimationLoader_Compress = 0x2,
+        AnimationLoader_InterpolateKeys = 0x4,
+        AnimationLoader_MemoryMap = 0x8,
+    };
+
+    // Quantized translation, rotation, and scale keys with constant track elimination, used by both
+    // compressed SDKMESH and CMO clips
+    class AnimationCompressedTracks
+    {
+    public:
+        // Largest allowed error per component of the translation, rotation quaternion, and scale
+        static constexpr float c_DefaultTolerance = 0.0005f;
+
+        AnimationCompressedTracks() = default;
+        ~AnimationCompressedTracks() = default;
+
+        AnimationCompressedTracks(AnimationCompressedTracks&&) = default;
+        AnimationCompressedTracks& operator= (AnimationCompressedTracks&&) = default;
+
+        AnimationCompressedTracks(AnimationCompressedTracks const&) = delete;
+        AnimationCompressedTracks& operator= (AnimationCompressedTracks const&) = delete;
+
+        // Appends a track and returns its index. Each channel uses the smallest encoding which
+        // reproduces every key within the tolerance. Rotations must be normalized.
+        uint32_t AddTrack(
+            size_t keyCount,
+            _In_reads_(keyCount) const DirectX::XMFLOAT3* translations,
+            _In_reads_(keyCount) const DirectX::XMFLOAT4* rotations,
+            _In_reads_(keyCount) const DirectX::XMFLOAT3* scales,
+            float tolerance = c_DefaultTolerance);
+
+        void Decompress(
+            uint32_t track,
+            uint32_t key,
+            _Out_ DirectX::XMVECTOR* translation,
+            _Out_ DirectX::XMVECTOR* rotation,
+            _Out_ DirectX::XMVECTOR* scale) const;
+
+        void Clear() noexcept
+        {
+            m_tracks.clear();
+            m_data.clear();
+        }
+
+        size_t GetTrackCount() const noexcept { return m_tracks.size(); }
+        uint32_t GetKeyCount(uint32_t track) const noexcept { return m_tracks[track].keyCount; }
+        size_t GetSizeInBytes() const noexcept { return m_tracks.size() * sizeof(Track) + m_data.size(); }
+
+    private:
+        enum Encoding : uint8_t
+        {
+            Encoding_Constant = 0,
+            Encoding_Quantized8,
+            Encoding_Quantized16,
+            Encoding_SmallestThree32,
+            Encoding_SmallestThree48,
+            Encoding_Raw,
+        };
+
+        struct Channel
+        {
+            uint32_t    offset;
+            Encoding    encoding;
+        };
+
+        struct Track
+        {
+            uint32_t    keyCount;
+            Channel     translation;
+            Channel     rotation;
+            Channel     scale;
+        };
+
+        Channel EncodeVector3(_In_reads_(count) const DirectX::XMFLOAT3* values, size_t count, float tolerance);
+        Channel EncodeQuaternion(_In_reads_(count) const DirectX::XMFLOAT4* values, size_t count, float tolerance);
+
+        DirectX::XMVECTOR XM_CALLCONV DecodeVector3(const Channel& channel, uint32_t key) const noexcept;
+
+        std::vector<Track>      m_tracks;
+        std::vector<uint8_t>    m_data;
+    };
+
+    // Immutable SDKMESH animation clip data which can be shared by any number of playback instances
+    class AnimationClipSDKMESH
+    {
+    public:
+        ~AnimationClipSDKMESH() = default;
+
+        AnimationClipSDKMESH(AnimationClipSDKMESH&&) = delete;
+        AnimationClipSDKMESH& operator= (AnimationClipSDKMESH&&) = delete;
+
+        AnimationClipSDKMESH(AnimationClipSDKMESH const&) = delete;
+        AnimationClipSDKMESH& operator= (AnimationClipSDKMESH const&) = delete;
+
+        // AnimationLoader_Compress quantizes the keys within the given tolerance and releases the float data.
+        // AnimationLoader_MemoryMap maps the file read-only and uses it in place rather than reading it into
+        // memory, so only the pages for tracks which are sampled are read from disk.
+        static HRESULT CreateFromFile(_In_z_ const wchar_t* fileName, std::shared_ptr<const AnimationClipSDKMESH>& clip,
+            uint32_t flags = AnimationLoader_Default,
+            float tolerance = AnimationCompressedTracks::c_DefaultTolerance);
+
+        uint32_t GetTrackCount() const noexcept;
+        uint32_t GetKeyCount() const noexcept;
+        uint32_t GetFramesPerSecond() const noexcept;
+
+        // Converts an animation time to a key index, looping the clip
+        uint32_t GetTick(double time) const noexcept;
+
+        // Returns the local transform for a single track at the given tick
+        DirectX::XMMATRIX XM_CALLCONV SampleTrack(uint32_t track, uint32_t tick) const;
+
+        void SampleTrack(
+            uint32_t track,
+            uint32_t tick,
+            _Out_ DirectX::XMVECTOR* scale,
+            _Out_ DirectX::XMVECTOR* rotation,
+            _Out_ DirectX::XMVECTOR* translation) const;
+
+        // Transcoded clips store each tick as structure-of-arrays streams for groups of 4 tracks
+        bool IsTranscoded() const noexcept { return !m_soaData.empty(); }
+        uint32_t GetTrackGroupCount() const noexcept { return m_trackGroups; }
+
+        // Writes GetTrackGroupCount() * 4 local transforms, indexed by track
+        void SampleTracks(uint32_t tick, _Out_writes_(GetTrackGroupCount() * 4) DirectX::XMMATRIX* trackTransforms) const;
+
+        bool IsCompressed() const noexcept { return m_compressed.GetTrackCount() > 0; }
+        const AnimationCompressedTracks& GetCompressedTracks() const noexcept { return m_compressed; }
+
+        // Compressed clips only keep the file header
+        const uint8_t* GetData() const noexcept { return m_animData; }
+        size_t GetDataSize() const noexcept { return m_animSize; }
+
+        // Maps each skeleton bone to a track index (or ModelBone::c_Invalid), cached while the skeleton is alive
+        using BoneToTrack = std::vector<uint32_t>;
+
+        std::shared_ptr<const BoneToTrack> GetBinding(const std::shared_ptr<const AnimationSkeleton>& skeleton) const;
+
+        void ClearBindingCache() const;
+
+    private:
+        AnimationClipSDKMESH() noexcept;
+
+        void Transcode();
+        void Compress(float tolerance);
+
+        std::unique_ptr<uint8_t[]>          m_animBlob;
+        std::shared_ptr<const uint8_t>      m_fileView;
+        const uint8_t*                      m_animData;
+        size_t                              m_animSize;
+        std::vector<std::wstring>           m_trackNames;
+        uint32_t                            m_trackGroups;
+        std::vector<DirectX::XMVECTOR>      m_soaData;
+        AnimationCompressedTracks           m_compressed;
+
+        struct CachedBinding
+        {
+            std::weak_ptr<const AnimationSkeleton>  skeleton;
+            std::shared_ptr<const BoneToTrack>      binding;
+        };
+
+        mutable std::mutex                          m_bindingLock;
+        mutable std::map<uint64_t, CachedBinding>   m_bindings;
+    };
+
+    enum AnimationPalette_Format : uint32_t
+    {
+        AnimationPalette_Float4x4 = 0,  // 64 bytes per bone, GetPalette returns a pointer with no copying
+        AnimationPalette_Float3x4,      // 48 bytes per bone, stored as transposed XMFLOAT3X4
+        AnimationPalette_Half3x4,       // 24 bytes per bone, transposed 3x4 in half-precision
+        AnimationPalette_DualQuaternion, // 32 bytes per bone, rotation then dual part as two XMFLOAT4, no scale
+    };
+
+    size_t GetPaletteBytesPerBone(AnimationPalette_Format format);
+
+    class AnimationBakedSDKMESH;
+
+    // Per-instance SDKMESH animation playback state
     class AnimationSDKMESH
     {
     public:
@@ -32,32 +219,294 @@ namespace DX
 
         HRESULT Load(_In_z_ const wchar_t* fileName);
 
+        // Keeps the skeleton from the last Bind(model) so binding the same model again doesn't rebuild it
+        void SetClip(std::shared_ptr<const AnimationClipSDKMESH> clip)
+        {
+            m_animTime = 0.0;
+            m_clip = std::move(clip);
+            m_boneToTrack.reset();
+            m_baked.reset();
+        }
+
+        const std::shared_ptr<const AnimationClipSDKMESH>& GetClip() const noexcept { return m_clip; }
+
         void Release()
         {
             m_animTime = 0.0;
-            m_animSize = 0;
-            m_animData.reset();
-            m_boneToTrack.clear();
-            m_animBones.reset();
+            m_clip.reset();
+            m_skeleton.reset();
+            m_skeletonModel = nullptr;
+            m_boneToTrack.reset();
+            m_baked.reset();
         }
 
         bool Bind(const DirectX::Model& model);
+        bool Bind(const DirectX::Model& model, std::shared_ptr<const AnimationSkeleton> skeleton);
+
+        // Optional precomputed palettes for the bound clip and skeleton, Apply then just copies the result
+        void SetBakedPalettes(std::shared_ptr<const AnimationBakedSDKMESH> baked);
+
+        void Update(float delta);
+
+        // Apply does not modify the instance and uses per-thread scratch memory, so it can be
+        // called concurrently from multiple threads. Bones with a zero entry in the optional mask
+        // use the model's bind pose rather than sampling the clip.
+        void Apply(
+            const DirectX::Model& model,
+            size_t nbones,
+            _Out_writes_(nbones) DirectX::XMMATRIX* boneTransforms,
+            _In_reads_opt_(model.bones.size()) const uint8_t* boneMask = nullptr) const;
+
+        // Writes the palette in another format, converting each bone as the pose is evaluated rather
+        // than in a separate pass. The palette holds nbones * GetPaletteBytesPerBone(format) bytes.
+        void Apply(
+            const DirectX::Model& model,
+            size_t nbones,
+            AnimationPalette_Format format,
+            _Out_writes_bytes_(nbones * GetPaletteBytesPerBone(format)) void* palette,
+            _In_reads_opt_(model.bones.size()) const uint8_t* boneMask = nullptr) const;
+
+        // Number of bones Apply samples from the clip with this mask, which is none with baked palettes
+        size_t GetSampledBoneCount(_In_opt_ const uint8_t* boneMask = nullptr) const;
+
+        // Evaluates many instances which share the same clip and skeleton in one call. Instances on the same
+        // tick share one evaluation, while each distinct tick is evaluated on its own as Apply would.
+        struct BatchItem
+        {
+            const AnimationSDKMESH*     animation;
+            double                      time;
+            DirectX::XMMATRIX*          boneTransforms;
+        };
+
+        static void ApplyBatch(
+            const DirectX::Model& model,
+            size_t nbones,
+            _In_reads_(count) const BatchItem* items,
+            size_t count);
+
+        // Blends this instance's sampled bones over the pose by weight (scaled per bone by the optional mask).
+        // Bones the clip doesn't animate are left unchanged. The optional weights receive the weight each bone
+        // was blended with, 0 for those left unchanged. Used by AnimationBlend.
+        void BlendLocal(
+            float weight,
+            _In_reads_opt_(nbones) const float* boneMask,
+            size_t nbones,
+            _Inout_updates_(nbones) AnimationLocalTransform* pose,
+            _Out_writes_opt_(nbones) float* weights = nullptr) const;
+
+        double GetTime() const noexcept { return m_animTime; }
+
+        // Jumps directly to the given time, which is looped when sampling
+        void Seek(double time) noexcept { m_animTime = time; }
+
+        const std::shared_ptr<const AnimationSkeleton>& GetSkeleton() const noexcept { return m_skeleton; }
+
+    private:
+        using BoneToTrack = AnimationClipSDKMESH::BoneToTrack;
+
+        void Evaluate(
+            const DirectX::Model& model,
+            uint32_t tick,
+            _Out_writes_(model.bones.size()) DirectX::XMMATRIX* absolute,
+            _Inout_opt_ DirectX::XMMATRIX* trackScratch,
+            AnimationPalette_Format format,
+            _Out_writes_bytes_(model.bones.size() * GetPaletteBytesPerBone(format)) void* palette,
+            _In_reads_opt_(model.bones.size()) const uint8_t* boneMask) const;
+
+        double                                      m_animTime;
+        std::shared_ptr<const AnimationClipSDKMESH> m_clip;
+        std::shared_ptr<const AnimationSkeleton>    m_skeleton;
+        const DirectX::Model*                       m_skeletonModel;
+        std::shared_ptr<const BoneToTrack>          m_boneToTrack;
+        std::shared_ptr<const AnimationBakedSDKMESH> m_baked;
+
+        friend class AnimationBakedSDKMESH;
+    };
+
+    // Final skinning palettes for every tick of an SDKMESH clip bound to a particular model
+    class AnimationBakedSDKMESH
+    {
+    public:
+        ~AnimationBakedSDKMESH() = default;
+
+        AnimationBakedSDKMESH(AnimationBakedSDKMESH&&) = delete;
+        AnimationBakedSDKMESH& operator= (AnimationBakedSDKMESH&&) = delete;
+
+        AnimationBakedSDKMESH(AnimationBakedSDKMESH const&) = delete;
+        AnimationBakedSDKMESH& operator= (AnimationBakedSDKMESH const&) = delete;
+
+        static std::shared_ptr<const AnimationBakedSDKMESH> Create(
+            const DirectX::Model& model,
+            std::shared_ptr<const AnimationClipSDKMESH> clip,
+            std::shared_ptr<const AnimationSkeleton> skeleton,
+            AnimationPalette_Format format = AnimationPalette_Float4x4);
+
+        AnimationPalette_Format GetFormat() const noexcept { return m_format; }
+        size_t GetBoneCount() const noexcept { return m_boneCount; }
+        uint32_t GetTickCount() const noexcept { return m_tickCount; }
+        size_t GetSizeInBytes() const noexcept { return m_data.size() * sizeof(DirectX::XMVECTOR); }
+
+        const AnimationClipSDKMESH* GetClip() const noexcept { return m_clip.get(); }
+        uint64_t GetSkeletonId() const noexcept { return m_skeletonId; }
+
+        // Only valid for AnimationPalette_Float4x4
+        const DirectX::XMMATRIX* GetPalette(uint32_t tick) const;
+
+        // Raw palette data in the baked format, suitable for copying directly into a constant buffer
+        const void* GetPaletteData(uint32_t tick) const;
+
+        // Copies or expands the palette for a tick into XMMATRIX form
+        void CopyPalette(uint32_t tick, size_t nbones, _Out_writes_(nbones) DirectX::XMMATRIX* boneTransforms) const;
+
+    private:
+        AnimationBakedSDKMESH() noexcept;
+
+        AnimationPalette_Format                     m_format;
+        size_t                                      m_boneCount;
+        uint32_t                                    m_tickCount;
+        size_t                                      m_tickStride;
+        uint64_t                                    m_skeletonId;
+        std::shared_ptr<const AnimationClipSDKMESH> m_clip;
+        std::vector<DirectX::XMVECTOR>              m_data;
+    };
+
+    // Plays SDKMESH clips which are too large to keep in memory. The keys are read in chunks of ticks, and only
+    // the chunks within a window around the playback time are resident, read ahead on a background thread.
+    class AnimationStreamSDKMESH
+    {
+    public:
+        AnimationStreamSDKMESH() noexcept;
+        ~AnimationStreamSDKMESH();
+
+        AnimationStreamSDKMESH(AnimationStreamSDKMESH&&) noexcept;
+        AnimationStreamSDKMESH& operator= (AnimationStreamSDKMESH&&) noexcept;
+
+        AnimationStreamSDKMESH(AnimationStreamSDKMESH const&) = delete;
+        AnimationStreamSDKMESH& operator= (AnimationStreamSDKMESH const&) = delete;
+
+        // Keeps windowSeconds of keys either side of the playback time, and prefetches the chunk after that.
+        // With a memory budget the window is reduced to fit, down to the current chunk and the next one, and
+        // a budget of 0 is sized from the window. Offsets are 64-bit, so the file can be
+        // larger than 4 GB.
+        HRESULT Load(_In_z_ const wchar_t* fileName, float windowSeconds = 2.f, size_t memoryBudget = 0);
+
+        void Release();
+
+        bool Bind(const DirectX::Model& model);
+        bool Bind(const DirectX::Model& model, std::shared_ptr<const AnimationSkeleton> skeleton);
 
+        // Both schedule the chunks around the new time, nearest first, and drop those outside the window
         void Update(float delta);
+        void Seek(double time);
+
+        double GetTime() const noexcept { return m_animTime; }
 
+        // A chunk which hasn't arrived yet is read immediately, which is counted by GetStallCount
         void Apply(
             const DirectX::Model& model,
             size_t nbones,
             _Out_writes_(nbones) DirectX::XMMATRIX* boneTransforms) const;
 
+        uint32_t GetTrackCount() const noexcept;
+        uint32_t GetKeyCount() const noexcept;
+        uint32_t GetFramesPerSecond() const noexcept;
+
+        size_t GetResidentBytes() const noexcept;
+        uint32_t GetStallCount() const noexcept;
+
     private:
-        double                              m_animTime;
-        std::unique_ptr<uint8_t[]>          m_animData;
-        size_t                              m_animSize;
-        std::vector<uint32_t>               m_boneToTrack;
-        DirectX::ModelBone::TransformArray  m_animBones;
+        struct Streamer;
+
+        double                                      m_animTime;
+        std::unique_ptr<Streamer>                   m_streamer;
+        std::shared_ptr<const AnimationSkeleton>    m_skeleton;
+        const DirectX::Model*                       m_skeletonModel;
+        std::vector<uint32_t>                       m_boneToTrack;
     };
 
+    // Immutable data for every clip in a CMO animation section, parsed in one pass and shared by any
+    // number of AnimationCMO instances
+    class AnimationLibraryCMO
+    {
+    public:
+        static constexpr uint32_t c_InvalidClip = uint32_t(-1);
+
+        ~AnimationLibraryCMO() = default;
+
+        AnimationLibraryCMO(AnimationLibraryCMO&&) = delete;
+        AnimationLibraryCMO& operator= (AnimationLibraryCMO&&) = delete;
+
+        AnimationLibraryCMO(AnimationLibraryCMO const&) = delete;
+        AnimationLibraryCMO& operator= (AnimationLibraryCMO const&) = delete;
+
+        // Flags and tolerance are as for AnimationCMO::Load
+        static HRESULT CreateFromFile(
+            _In_z_ const wchar_t* fileName,
+            size_t offset,
+            std::shared_ptr<const AnimationLibraryCMO>& library,
+            uint32_t flags = AnimationLoader_Default,
+            float tolerance = AnimationCompressedTracks::c_DefaultTolerance);
+
+        uint32_t GetClipCount() const noexcept { return static_cast<uint32_t>(m_clips.size()); }
+
+        // Case-insensitive hashed lookup, returns c_InvalidClip if there is no clip with this name
+        uint32_t FindClip(_In_z_ const wchar_t* name) const;
+
+        const std::wstring& GetClipName(uint32_t clip) const noexcept { return m_clips[clip].name; }
+        float GetStartTime(uint32_t clip) const noexcept { return m_clips[clip].startTime; }
+        float GetEndTime(uint32_t clip) const noexcept { return m_clips[clip].endTime; }
+
+        bool IsCompressed() const noexcept { return m_compressed.GetTrackCount() > 0; }
+
+        // Sorted distinct times of every key in the clip, which is where the pose changes when keys are held
+        void GetKeyTimes(uint32_t clip, std::vector<float>& times) const;
+
+    private:
+        friend class AnimationCMO;
+
+        // Keys are stored grouped by bone and sorted by time within each bone
+        struct BoneKeys
+        {
+            uint32_t firstKey;
+            uint32_t keyCount;
+        };
+
+        struct ClipInfo
+        {
+            std::wstring    name;
+            float           startTime;
+            float           endTime;
+            uint32_t        firstBone;      // Index of the clip's first BoneKeys, and its first compressed track
+            uint32_t        boneCount;
+        };
+
+        AnimationLibraryCMO() noexcept;
+
+        static HRESULT Create(
+            _In_z_ const wchar_t* fileName,
+            size_t offset,
+            _In_opt_z_ const wchar_t* clipName,
+            bool onlyOne,
+            uint32_t flags,
+            float tolerance,
+            std::shared_ptr<const AnimationLibraryCMO>& library);
+
+        void Allocate(size_t keyCount, size_t boneCount, bool transforms);
+        bool Compress(float tolerance);
+
+        std::vector<ClipInfo>                       m_clips;
+        std::unordered_map<std::wstring, uint32_t>  m_clipNames;
+        DirectX::ModelBone::TransformArray          m_data;
+        DirectX::XMMATRIX*                          m_transforms;   // nullptr when compressed
+        float*                                      m_keyTimes;
+        BoneKeys*                                   m_boneKeys;
+        size_t                                      m_keyCount;
+        size_t                                      m_boneCount;
+        AnimationCompressedTracks                   m_compressed;
+        bool                                        m_interpolate;
+    };
+
+    // Per-instance CMO animation playback state
     class AnimationCMO
     {
     public:
@@ -70,33 +519,130 @@ namespace DX
         AnimationCMO(AnimationCMO const&) = delete;
         AnimationCMO& operator= (AnimationCMO const&) = delete;
 
-        HRESULT Load(_In_z_ const wchar_t* fileName, size_t offset, _In_opt_z_ const wchar_t* clipName = nullptr);
+        // AnimationLoader_Compress decomposes and quantizes the keys within the given tolerance. Clips with keys
+        // which can't be decomposed that accurately (such as those with shear) are kept as full matrices.
+        // AnimationLoader_InterpolateKeys blends between keys rather than holding each one until the next,
+        // which is required for clips written by animreduce. AnimationLoader_MemoryMap parses the clips directly
+        // from a read-only mapping of the file rather than reading it into memory first.
+        HRESULT Load(_In_z_ const wchar_t* fileName, size_t offset, _In_opt_z_ const wchar_t* clipName = nullptr,
+            uint32_t flags = AnimationLoader_Default,
+            float tolerance = AnimationCompressedTracks::c_DefaultTolerance);
+
+        // Plays a clip from a shared library, which needs to be bound again afterwards
+        void SetClip(std::shared_ptr<const AnimationLibraryCMO> library, uint32_t clip);
+
+        const std::shared_ptr<const AnimationLibraryCMO>& GetLibrary() const noexcept { return m_library; }
 
         void Release()
         {
             m_animTime = m_startTime = m_endTime = 0.f;
-            m_keys.clear();
-            m_transforms.reset();
-            m_animBones.reset();
+            m_library.reset();
+            m_boneKeys = nullptr;
+            m_boneCount = 0;
+            m_firstTrack = 0;
+            m_cursors.clear();
+            m_skeleton.reset();
+            m_skeletonModel = nullptr;
         }
 
+        bool IsCompressed() const noexcept { return m_library && m_library->IsCompressed(); }
+
         void Bind(const DirectX::Model& model);
+        void Bind(const DirectX::Model& model, std::shared_ptr<const AnimationSkeleton> skeleton);
 
         void Update(float delta);
 
+        // Jumps directly to the given time (wrapped to the clip length) for scrubbing
+        void Seek(float time);
+
+        float GetTime() const noexcept { return m_animTime; }
+
+        // Bones with a zero entry in the optional mask use the model's bind pose
         void Apply(
             const DirectX::Model& model,
             size_t nbones,
-            _Out_writes_(nbones) DirectX::XMMATRIX* boneTransforms) const;
+            _Out_writes_(nbones) DirectX::XMMATRIX* boneTransforms,
+            _In_reads_opt_(model.bones.size()) const uint8_t* boneMask = nullptr) const;
+
+        // As for AnimationSDKMESH::Apply with a palette format
+        void Apply(
+            const DirectX::Model& model,
+            size_t nbones,
+            AnimationPalette_Format format,
+            _Out_writes_bytes_(nbones * GetPaletteBytesPerBone(format)) void* palette,
+            _In_reads_opt_(model.bones.size()) const uint8_t* boneMask = nullptr) const;
+
+        // Number of bones Apply samples from the clip at the current time with this mask
+        size_t GetSampledBoneCount(_In_opt_ const uint8_t* boneMask = nullptr) const;
+
+        // As for AnimationSDKMESH::BlendLocal
+        void BlendLocal(
+            float weight,
+            _In_reads_opt_(nbones) const float* boneMask,
+            size_t nbones,
+            _Inout_updates_(nbones) AnimationLocalTransform* pose,
+            _Out_writes_opt_(nbones) float* weights = nullptr) const;
+
+        const std::shared_ptr<const AnimationSkeleton>& GetSkeleton() const noexcept { return m_skeleton; }
 
     private:
-        using Key = std::pair<uint32_t, float>;
-
-        float                               m_animTime;
-        float                               m_startTime;
-        float                               m_endTime;
-        std::vector<Key>                    m_keys;
-        DirectX::ModelBone::TransformArray  m_transforms;
-        DirectX::ModelBone::TransformArray  m_animBones;
+        using BoneKeys = AnimationLibraryCMO::BoneKeys;
+
+        void UpdateCursors();
+
+        DirectX::XMMATRIX XM_CALLCONV SampleBone(uint32_t bone, uint32_t cursor) const;
+
+        void SampleBone(
+            uint32_t bone,
+            uint32_t cursor,
+            _Out_ DirectX::XMVECTOR* scale,
+            _Out_ DirectX::XMVECTOR* rotation,
+            _Out_ DirectX::XMVECTOR* translation) const;
+
+        float                                       m_animTime;
+        float                                       m_startTime;
+        float                                       m_endTime;
+        std::shared_ptr<const AnimationLibraryCMO>  m_library;
+        const BoneKeys*                             m_boneKeys;
+        uint32_t                                    m_boneCount;
+        uint32_t                                    m_firstTrack;
+        std::vector<uint32_t>                       m_cursors;
+        std::shared_ptr<const AnimationSkeleton>    m_skeleton;
+        const DirectX::Model*                       m_skeletonModel;
+    };
+
+    // Cross-fades and layers several playing instances in local space, then evaluates the hierarchy once
+    class AnimationBlend
+    {
+    public:
+        // Exactly one of sdkmesh or cmo is set. Each layer is blended over the result of the layers before it,
+        // so a cross-fade is the outgoing clip followed by the incoming clip weighted by the fade, and a
+        // partial-body layer (such as upper body aiming) uses a bone mask of 0 or 1 per bone.
+        struct Layer
+        {
+            const AnimationSDKMESH*     sdkmesh;
+            const AnimationCMO*         cmo;
+            float                       weight;
+            const float*                boneMask;   // Optional per-bone weights, multiplied by weight
+        };
+
+        // All layers must be bound to the model. Each blended bone is composed in the order used by the clip type
+        // with the larger share of it: rotation * scale * translation for SDKMESH, scale * rotation * translation
+        // for CMO. Bones no layer animates use the model's bone matrices, so a single layer at full weight gives
+        // the same palette as that instance's Apply.
+        static void Apply(
+            const DirectX::Model& model,
+            _In_reads_(count) const Layer* layers,
+            size_t count,
+            size_t nbones,
+            _Out_writes_(nbones) DirectX::XMMATRIX* boneTransforms);
+
+        static void Apply(
+            const DirectX::Model& model,
+            _In_reads_(count) const Layer* layers,
+            size_t count,
+            size_t nbones,
+            AnimationPalette_Format format,
+            _Out_writes_bytes_(nbones * GetPaletteBytesPerBone(format)) void* palette);
     };
 }
@@ -0,0 +1,205 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationAsyncLoader.cpp
+//
+// Background loading of SDKMESH and CMO animation clips on a loader thread pool
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "AnimationAsyncLoader.h"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+using namespace DX;
+
+namespace
+{
+    // Loader errors are reported through the request rather than escaping the worker thread
+    template<typename TLoad>
+    HRESULT RunLoad(TLoad&& load) noexcept
+    {
+        try
+        {
+            return load();
+        }
+        catch (const std::bad_alloc&)
+        {
+            return E_OUTOFMEMORY;
+        }
+        catch (...)
+        {
+            return E_FAIL;
+        }
+    }
+}
+
+AnimationAsyncLoader::AnimationAsyncLoader(size_t threadCount) :
+    m_sequence(0),
+    m_shutdown(false)
+{
+    threadCount = std::max<size_t>(1, threadCount);
+
+    m_threads.reserve(threadCount);
+    for (size_t j = 0; j < threadCount; ++j)
+    {
+        m_threads.emplace_back(&AnimationAsyncLoader::WorkerThread, this);
+    }
+}
+
+AnimationAsyncLoader::~AnimationAsyncLoader()
+{
+    CancelAll();
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_shutdown = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& it : m_threads)
+    {
+        it.join();
+    }
+}
+
+_Use_decl_annotations_
+AnimationLoadRequest<AnimationClipSDKMESH> AnimationAsyncLoader::LoadSDKMESH(
+    const wchar_t* fileName,
+    uint32_t flags,
+    float tolerance,
+    Priority priority)
+{
+    if (!fileName)
+    {
+        throw std::invalid_argument("File name required");
+    }
+
+    using Request = AnimationLoadRequest<AnimationClipSDKMESH>;
+
+    Request request;
+    request.m_state = std::make_shared<Request::State>();
+
+    Enqueue(priority, [state = request.m_state] { return state->IsQueued(); },
+        [state = request.m_state, name = std::wstring(fileName), flags, tolerance](bool cancel)
+        {
+            if (cancel)
+            {
+                state->Cancel();
+                return;
+            }
+
+            if (!state->Start())
+                return;
+
+            std::shared_ptr<const AnimationClipSDKMESH> clip;
+            const HRESULT hr = RunLoad([&]
+                {
+                    return AnimationClipSDKMESH::CreateFromFile(name.c_str(), clip, flags, tolerance);
+                });
+
+            state->Finish(hr, std::move(clip));
+        });
+
+    return request;
+}
+
+_Use_decl_annotations_
+AnimationLoadRequest<AnimationLibraryCMO> AnimationAsyncLoader::LoadCMO(
+    const wchar_t* fileName,
+    size_t offset,
+    uint32_t flags,
+    float tolerance,
+    Priority priority)
+{
+    if (!fileName)
+    {
+        throw std::invalid_argument("File name required");
+    }
+
+    using Request = AnimationLoadRequest<AnimationLibraryCMO>;
+
+    Request request;
+    request.m_state = std::make_shared<Request::State>();
+
+    Enqueue(priority, [state = request.m_state] { return state->IsQueued(); },
+        [state = request.m_state, name = std::wstring(fileName), offset, flags, tolerance](bool cancel)
+        {
+            if (cancel)
+            {
+                state->Cancel();
+                return;
+            }
+
+            if (!state->Start())
+                return;
+
+            std::shared_ptr<const AnimationLibraryCMO> library;
+            const HRESULT hr = RunLoad([&]
+                {
+                    return AnimationLibraryCMO::CreateFromFile(name.c_str(), offset, library, flags, tolerance);
+                });
+
+            state->Finish(hr, std::move(library));
+        });
+
+    return request;
+}
+
+void AnimationAsyncLoader::CancelAll()
+{
+    std::vector<Job> jobs;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        std::swap(jobs, m_jobs);
+    }
+
+    for (auto& job : jobs)
+    {
+        job.run(true);
+    }
+}
+
+size_t AnimationAsyncLoader::GetPendingCount() const
+{
+    // Cancelled requests stay in the heap until a worker pops them, so they are skipped here
+    std::lock_guard<std::mutex> lock(m_lock);
+    return static_cast<size_t>(std::count_if(m_jobs.cbegin(), m_jobs.cend(),
+        [](const Job& job) { return job.queued(); }));
+}
+
+void AnimationAsyncLoader::Enqueue(Priority priority, std::function<bool()>&& queued, std::function<void(bool)>&& run)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_jobs.push_back(Job{ priority, m_sequence++, std::move(queued), std::move(run) });
+        std::push_heap(m_jobs.begin(), m_jobs.end());
+    }
+    m_wake.notify_one();
+}
+
+void AnimationAsyncLoader::WorkerThread()
+{
+    for (;;)
+    {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wake.wait(lock, [&] { return m_shutdown || !m_jobs.empty(); });
+
+            if (m_shutdown)
+                return;
+
+            std::pop_heap(m_jobs.begin(), m_jobs.end());
+            job = std::move(m_jobs.back());
+            m_jobs.pop_back();
+        }
+
+        job.run(false);
+    }
+}
@@ -0,0 +1,225 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationAsyncLoader.h
+//
+// Background loading of SDKMESH and CMO animation clips on a loader thread pool
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "Animation.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace DX
+{
+    // Handle to a pending load which the game thread can poll, wait on, or cancel
+    template<typename T>
+    class AnimationLoadRequest
+    {
+    public:
+        AnimationLoadRequest() = default;
+
+        bool IsValid() const noexcept { return m_state != nullptr; }
+
+        bool IsReady() const
+        {
+            if (!m_state)
+                return false;
+
+            std::lock_guard<std::mutex> lock(m_state->lock);
+            return m_state->phase == State::Phase_Done;
+        }
+
+        // E_PENDING until the load completes, E_ABORT if it was cancelled
+        HRESULT GetStatus() const
+        {
+            if (!m_state)
+                return E_UNEXPECTED;
+
+            std::lock_guard<std::mutex> lock(m_state->lock);
+            return (m_state->phase == State::Phase_Done) ? m_state->status : E_PENDING;
+        }
+
+        // The loaded data, or nullptr if the load is still pending or failed
+        std::shared_ptr<const T> GetResult() const
+        {
+            if (!m_state)
+                return nullptr;
+
+            std::lock_guard<std::mutex> lock(m_state->lock);
+            return (m_state->phase == State::Phase_Done) ? m_state->result : nullptr;
+        }
+
+        // Blocks until the load completes
+        HRESULT Wait() const
+        {
+            if (!m_state)
+                return E_UNEXPECTED;
+
+            std::unique_lock<std::mutex> lock(m_state->lock);
+            m_state->done.wait(lock, [&] { return m_state->phase == State::Phase_Done; });
+            return m_state->status;
+        }
+
+        // A queued load is dropped, a load already in progress completes but its result is discarded
+        void Cancel()
+        {
+            if (m_state)
+            {
+                m_state->Cancel();
+            }
+        }
+
+    private:
+        friend class AnimationAsyncLoader;
+
+        struct State
+        {
+            enum Phase : uint32_t
+            {
+                Phase_Queued = 0,
+                Phase_Running,
+                Phase_Done,
+            };
+
+            std::mutex                  lock;
+            std::condition_variable     done;
+            Phase                       phase = Phase_Queued;
+            bool                        cancelled = false;
+            HRESULT                     status = E_PENDING;
+            std::shared_ptr<const T>    result;
+
+            bool IsQueued()
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                return phase == Phase_Queued;
+            }
+
+            bool Start()
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (phase != Phase_Queued)
+                    return false;
+
+                phase = Phase_Running;
+                return true;
+            }
+
+            void Finish(HRESULT hr, std::shared_ptr<const T> data)
+            {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (phase == Phase_Done)
+                        return;
+
+                    if (cancelled)
+                    {
+                        hr = E_ABORT;
+                        data.reset();
+                    }
+
+                    status = hr;
+                    result = (SUCCEEDED(hr)) ? std::move(data) : nullptr;
+                    phase = Phase_Done;
+                }
+                done.notify_all();
+            }
+
+            void Cancel()
+            {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    cancelled = true;
+                    if (phase != Phase_Queued)
+                        return;
+
+                    status = E_ABORT;
+                    phase = Phase_Done;
+                }
+                done.notify_all();
+            }
+        };
+
+        std::shared_ptr<State> m_state;
+    };
+
+    class AnimationAsyncLoader
+    {
+    public:
+        enum Priority : uint32_t
+        {
+            Priority_Low = 0,
+            Priority_Normal,
+            Priority_High,
+        };
+
+        explicit AnimationAsyncLoader(size_t threadCount = 2);
+
+        // Cancels any queued loads and waits for those in progress
+        ~AnimationAsyncLoader();
+
+        AnimationAsyncLoader(AnimationAsyncLoader&&) = delete;
+        AnimationAsyncLoader& operator= (AnimationAsyncLoader&&) = delete;
+
+        AnimationAsyncLoader(AnimationAsyncLoader const&) = delete;
+        AnimationAsyncLoader& operator= (AnimationAsyncLoader const&) = delete;
+
+        // Loads are started in priority order, and in the order they were requested within a priority
+        AnimationLoadRequest<AnimationClipSDKMESH> LoadSDKMESH(
+            _In_z_ const wchar_t* fileName,
+            uint32_t flags = AnimationLoader_Default,
+            float tolerance = AnimationCompressedTracks::c_DefaultTolerance,
+            Priority priority = Priority_Normal);
+
+        AnimationLoadRequest<AnimationLibraryCMO> LoadCMO(
+            _In_z_ const wchar_t* fileName,
+            size_t offset,
+            uint32_t flags = AnimationLoader_Default,
+            float tolerance = AnimationCompressedTracks::c_DefaultTolerance,
+            Priority priority = Priority_Normal);
+
+        // Cancels every load which hasn't started yet
+        void CancelAll();
+
+        // Loads which haven't started yet, not counting those cancelled while queued
+        size_t GetPendingCount() const;
+
+    private:
+        struct Job
+        {
+            Priority                    priority;
+            uint64_t                    sequence;
+            std::function<bool()>       queued; // False once the request has been cancelled
+            std::function<void(bool)>   run;    // Called with true when the job is cancelled before starting
+
+            bool operator< (const Job& other) const noexcept
+            {
+                if (priority != other.priority)
+                    return priority < other.priority;
+
+                return sequence > other.sequence;
+            }
+        };
+
+        void Enqueue(Priority priority, std::function<bool()>&& queued, std::function<void(bool)>&& run);
+        void WorkerThread();
+
+        // Kept as a heap rather than a priority_queue so the pending jobs can be inspected
+        mutable std::mutex          m_lock;
+        std::condition_variable     m_wake;
+        std::vector<Job>            m_jobs;
+        uint64_t                    m_sequence;
+        bool                        m_shutdown;
+        std::vector<std::thread>    m_threads;
+    };
+}
@@ -0,0 +1,349 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationBounds.cpp
+//
+// Precomputed bounding volumes for SDKMESH and CMO animation clips, for culling
+// animated models without evaluating their pose
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "AnimationBounds.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace DX;
+using namespace DirectX;
+
+namespace
+{
+    // Without per-bone bounds, each bone contributes its own position
+    std::vector<BoundingSphere> GetBonePositions(const Model& model)
+    {
+        const size_t nbones = model.bones.size();
+
+        std::vector<BoundingSphere> positions(nbones);
+        for (size_t j = 0; j < nbones; ++j)
+        {
+            const XMMATRIX bindPose = XMMatrixInverse(nullptr, model.invBindPoseMatrices[j]);
+            XMStoreFloat3(&positions[j].Center, bindPose.r[3]);
+            positions[j].Radius = 0.f;
+        }
+
+        return positions;
+    }
+}
+
+AnimationClipBounds::AnimationClipBounds() noexcept :
+    m_duration(0.0)
+{
+}
+
+_Use_decl_annotations_
+void AnimationClipBounds::ComputeBoneBounds(
+    size_t vertexCount,
+    const XMFLOAT3* positions,
+    const uint32_t* blendIndices,
+    const XMFLOAT4* blendWeights,
+    size_t nbones,
+    BoundingSphere* boneBounds)
+{
+    if (vertexCount > 0 && (!positions || !blendIndices))
+    {
+        throw std::invalid_argument("Vertex positions and blend indices required");
+    }
+
+    if (nbones > 0 && !boneBounds)
+    {
+        throw std::invalid_argument("Bone bounds array required");
+    }
+
+    std::vector<std::vector<XMFLOAT3>> points(nbones);
+
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        const uint32_t packed = blendIndices[v];
+
+        for (uint32_t k = 0; k < 4; ++k)
+        {
+            if (blendWeights && (&blendWeights[v].x)[k] <= 0.f)
+                continue;
+
+            const uint32_t index = (packed >> (8 * k)) & 0xff;
+            if (index >= nbones)
+            {
+                throw std::out_of_range("Blend index is larger than the bone count");
+            }
+
+            points[index].push_back(positions[v]);
+        }
+    }
+
+    for (size_t j = 0; j < nbones; ++j)
+    {
+        if (points[j].empty())
+        {
+            boneBounds[j].Center = XMFLOAT3(0.f, 0.f, 0.f);
+            boneBounds[j].Radius = -1.f;
+        }
+        else
+        {
+            BoundingSphere::CreateFromPoints(boneBounds[j], points[j].size(), points[j].data(), sizeof(XMFLOAT3));
+        }
+    }
+}
+
+_Use_decl_annotations_
+std::shared_ptr<const AnimationClipBounds> AnimationClipBounds::Create(
+    const Model& model,
+    std::shared_ptr<const AnimationClipSDKMESH> clip,
+    uint32_t segmentCount,
+    const BoundingSphere* boneBounds,
+    float padding)
+{
+    if (!clip)
+    {
+        throw std::invalid_argument("Clip required");
+    }
+
+    const uint32_t ticks = clip->GetKeyCount();
+    const uint32_t fps = clip->GetFramesPerSecond();
+    if (!ticks || !fps)
+    {
+        throw std::runtime_error("Clip has no keys");
+    }
+
+    AnimationSDKMESH anim;
+    anim.SetClip(clip);
+    anim.Bind(model);
+
+    std::vector<BoundingSphere> bonePositions;
+    if (!boneBounds)
+    {
+        bonePositions = GetBonePositions(model);
+        boneBounds = bonePositions.data();
+    }
+
+    std::shared_ptr<AnimationClipBounds> bounds(new AnimationClipBounds);
+    bounds->Initialize(segmentCount, double(ticks) / double(fps));
+
+    const size_t nbones = model.bones.size();
+    auto palette = ModelBone::MakeArray(nbones);
+
+    // Playback holds each key for a whole tick, so every pose the clip can show is visited
+    for (uint32_t tick = 0; tick < ticks; ++tick)
+    {
+        anim.Seek((double(tick) + 0.5) / double(fps));
+        anim.Apply(model, nbones, palette.get());
+
+        const auto segment = static_cast<uint32_t>(uint64_t(tick) * segmentCount / ticks);
+        bounds->AddPose(model, segment, palette.get(), boneBounds, padding);
+    }
+
+    bounds->Finalize();
+
+    return bounds;
+}
+
+_Use_decl_annotations_
+std::shared_ptr<const AnimationClipBounds> AnimationClipBounds::Create(
+    const Model& model,
+    std::shared_ptr<const AnimationLibraryCMO> library,
+    uint32_t clip,
+    uint32_t segmentCount,
+    const BoundingSphere* boneBounds,
+    float padding,
+    float sampleRate)
+{
+    if (!library || clip >= library->GetClipCount())
+    {
+        throw std::invalid_argument("Invalid clip");
+    }
+
+    AnimationCMO anim;
+    anim.SetClip(library, clip);
+    anim.Bind(model);
+
+    std::vector<BoundingSphere> bonePositions;
+    if (!boneBounds)
+    {
+        bonePositions = GetBonePositions(model);
+        boneBounds = bonePositions.data();
+    }
+
+    const float duration = std::max(library->GetEndTime(clip), 0.f);
+
+    std::shared_ptr<AnimationClipBounds> bounds(new AnimationClipBounds);
+    bounds->Initialize(segmentCount, double(duration));
+
+    // Held keys only change the pose at a key, so sampling each segment start as well covers every pose
+    // visible within each segment. The regular samples cover clips which interpolate between keys.
+    std::vector<float> times;
+    library->GetKeyTimes(clip, times);
+
+    times.push_back(0.f);
+    for (uint32_t j = 1; j < segmentCount; ++j)
+    {
+        times.push_back(duration * float(j) / float(segmentCount));
+    }
+
+    if (sampleRate > 0.f && duration > 0.f)
+    {
+        const auto steps = static_cast<uint32_t>(std::ceil(duration * sampleRate));
+        for (uint32_t j = 1; j < steps; ++j)
+        {
+            times.push_back(duration * float(j) / float(steps));
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
+
+    const size_t nbones = model.bones.size();
+    auto palette = ModelBone::MakeArray(nbones);
+
+    for (const float time : times)
+    {
+        if (time < 0.f || (time >= duration && duration > 0.f))
+            continue;
+
+        anim.Seek(time);
+        anim.Apply(model, nbones, palette.get());
+
+        bounds->AddPose(model, bounds->GetSegment(time), palette.get(), boneBounds, padding);
+    }
+
+    if (duration > 0.f)
+    {
+        // Playback shows the end pose before wrapping, but Seek wraps the end time back to the start, so
+        // advance to it with Update instead. It belongs to the last segment.
+        anim.Seek(0.f);
+        anim.Update(duration);
+        anim.Apply(model, nbones, palette.get());
+
+        bounds->AddPose(model, bounds->GetSegmentCount() - 1, palette.get(), boneBounds, padding);
+    }
+
+    bounds->Finalize();
+
+    return bounds;
+}
+
+uint32_t AnimationClipBounds::GetSegment(double time) const noexcept
+{
+    const auto count = static_cast<uint32_t>(m_segments.size());
+    if (count <= 1 || m_duration <= 0.0)
+        return 0;
+
+    time = fmod(time, m_duration);
+    if (time < 0.0)
+    {
+        time += m_duration;
+    }
+
+    const auto segment = static_cast<uint32_t>(time / m_duration * double(count));
+    return std::min(segment, count - 1);
+}
+
+void AnimationClipBounds::Initialize(uint32_t segmentCount, double duration)
+{
+    if (!segmentCount)
+    {
+        throw std::invalid_argument("At least one segment required");
+    }
+
+    m_duration = duration;
+    m_segments.resize(segmentCount);
+    m_segmentUsed.assign(segmentCount, 0);
+}
+
+// Each bone's bounds are moved by its skinning transform and grown by the largest axis scale
+_Use_decl_annotations_
+void AnimationClipBounds::AddPose(
+    const Model& model,
+    uint32_t segment,
+    const XMMATRIX* boneTransforms,
+    const BoundingSphere* boneBounds,
+    float padding)
+{
+    XMVECTOR vmin = g_XMFltMax;
+    XMVECTOR vmax = XMVectorNegate(g_XMFltMax);
+
+    const size_t nbones = model.bones.size();
+    for (size_t j = 0; j < nbones; ++j)
+    {
+        const auto& sphere = boneBounds[j];
+        if (sphere.Radius < 0.f)
+            continue;
+
+        const XMMATRIX& m = boneTransforms[j];
+
+        const XMVECTOR scale = XMVectorMax(XMVectorMax(
+            XMVector3LengthSq(m.r[0]), XMVector3LengthSq(m.r[1])), XMVector3LengthSq(m.r[2]));
+
+        const XMVECTOR center = XMVector3Transform(XMLoadFloat3(&sphere.Center), m);
+        const XMVECTOR radius = XMVectorMultiplyAdd(XMVectorSqrt(scale), XMVectorReplicate(sphere.Radius),
+            XMVectorReplicate(padding));
+
+        vmin = XMVectorMin(vmin, XMVectorSubtract(center, radius));
+        vmax = XMVectorMax(vmax, XMVectorAdd(center, radius));
+    }
+
+    if (XMVector3Greater(vmin, vmax))
+        return;
+
+    BoundingBox box;
+    BoundingBox::CreateFromPoints(box, vmin, vmax);
+
+    if (m_segmentUsed[segment])
+    {
+        BoundingBox::CreateMerged(m_segments[segment], m_segments[segment], box);
+    }
+    else
+    {
+        m_segments[segment] = box;
+        m_segmentUsed[segment] = 1;
+    }
+}
+
+// Segments which no pose fell in (more segments than ticks) use the bounds of the whole clip
+void AnimationClipBounds::Finalize()
+{
+    bool any = false;
+    for (size_t j = 0; j < m_segments.size(); ++j)
+    {
+        if (!m_segmentUsed[j])
+            continue;
+
+        if (any)
+        {
+            BoundingBox::CreateMerged(m_box, m_box, m_segments[j]);
+        }
+        else
+        {
+            m_box = m_segments[j];
+            any = true;
+        }
+    }
+
+    if (!any)
+    {
+        throw std::runtime_error("Clip bounds are empty");
+    }
+
+    for (size_t j = 0; j < m_segments.size(); ++j)
+    {
+        if (!m_segmentUsed[j])
+        {
+            m_segments[j] = m_box;
+        }
+    }
+
+    BoundingSphere::CreateFromBoundingBox(m_sphere, m_box);
+
+    m_segmentUsed.clear();
+    m_segmentUsed.shrink_to_fit();
+}
@@ -0,0 +1,101 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationBounds.h
+//
+// Precomputed bounding volumes for SDKMESH and CMO animation clips, for culling
+// animated models without evaluating their pose
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "Animation.h"
+
+#include <DirectXCollision.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace DX
+{
+    // Conservative model-space bounds of a clip played on a particular model, for the whole clip and for
+    // equal time segments of it. Transform by the world matrix before testing against the view frustum.
+    class AnimationClipBounds
+    {
+    public:
+        ~AnimationClipBounds() = default;
+
+        AnimationClipBounds(AnimationClipBounds&&) = delete;
+        AnimationClipBounds& operator= (AnimationClipBounds&&) = delete;
+
+        AnimationClipBounds(AnimationClipBounds const&) = delete;
+        AnimationClipBounds& operator= (AnimationClipBounds const&) = delete;
+
+        // Bind pose bounds of the vertices influenced by each bone, and a radius of -1 for bones which don't
+        // influence any vertices. Blend indices are packed one byte per influence as in
+        // VertexPositionNormalTextureSkinning, and influences with a zero weight are ignored.
+        static void ComputeBoneBounds(
+            size_t vertexCount,
+            _In_reads_(vertexCount) const DirectX::XMFLOAT3* positions,
+            _In_reads_(vertexCount) const uint32_t* blendIndices,
+            _In_reads_opt_(vertexCount) const DirectX::XMFLOAT4* blendWeights,
+            size_t nbones,
+            _Out_writes_(nbones) DirectX::BoundingSphere* boneBounds);
+
+        // Evaluates every pose of the clip. Each bone's bounds are carried through its skinning transform,
+        // which contains every skinned vertex. Without bone bounds, the bone positions are used and the
+        // padding should cover the mesh around them. The padding is added to the bounds in either case.
+        static std::shared_ptr<const AnimationClipBounds> Create(
+            const DirectX::Model& model,
+            std::shared_ptr<const AnimationClipSDKMESH> clip,
+            uint32_t segmentCount = 1,
+            _In_reads_opt_(model.bones.size()) const DirectX::BoundingSphere* boneBounds = nullptr,
+            float padding = 0.f);
+
+        // Samples the pose at every key, every segment start, the end time, and at least sampleRate times a
+        // second. Bounds for clips which hold keys are exact. With AnimationLoader_InterpolateKeys, motion
+        // between samples isn't bounded, so the result is approximate: raise sampleRate or the padding to
+        // cover fast movement.
+        static std::shared_ptr<const AnimationClipBounds> Create(
+            const DirectX::Model& model,
+            std::shared_ptr<const AnimationLibraryCMO> library,
+            uint32_t clip,
+            uint32_t segmentCount = 1,
+            _In_reads_opt_(model.bones.size()) const DirectX::BoundingSphere* boneBounds = nullptr,
+            float padding = 0.f,
+            float sampleRate = 30.f);
+
+        const DirectX::BoundingBox& GetBox() const noexcept { return m_box; }
+        const DirectX::BoundingSphere& GetSphere() const noexcept { return m_sphere; }
+
+        uint32_t GetSegmentCount() const noexcept { return static_cast<uint32_t>(m_segments.size()); }
+        double GetDuration() const noexcept { return m_duration; }
+
+        const DirectX::BoundingBox& GetSegmentBox(uint32_t segment) const noexcept { return m_segments[segment]; }
+
+        // Segment for a playback time, wrapped to the clip length as playback does
+        uint32_t GetSegment(double time) const noexcept;
+
+        const DirectX::BoundingBox& GetBox(double time) const noexcept { return m_segments[GetSegment(time)]; }
+
+    private:
+        AnimationClipBounds() noexcept;
+
+        void Initialize(uint32_t segmentCount, double duration);
+        void AddPose(
+            const DirectX::Model& model,
+            uint32_t segment,
+            _In_reads_(model.bones.size()) const DirectX::XMMATRIX* boneTransforms,
+            _In_reads_opt_(model.bones.size()) const DirectX::BoundingSphere* boneBounds,
+            float padding);
+        void Finalize();
+
+        double                              m_duration;
+        DirectX::BoundingBox                m_box;
+        DirectX::BoundingSphere             m_sphere;
+        std::vector<DirectX::BoundingBox>   m_segments;
+        std::vector<uint8_t>                m_segmentUsed;
+    };
+}
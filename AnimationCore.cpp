@@ -0,0 +1,211 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationCore.cpp
+//
+// Skeleton and pose evaluation shared by the animation playback classes. This only
+// depends on DirectXMath, so it also builds without the Windows SDK or Direct3D, for
+// example to evaluate hitboxes on a dedicated server.
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+
+// No pch.h, which pulls in Windows.h and Direct3D
+#include "AnimationCore.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cwctype>
+#include <stdexcept>
+
+using namespace DX;
+using namespace DirectX;
+
+namespace
+{
+    std::atomic<uint64_t> s_skeletonId(0);
+}
+
+AnimationSkeleton::AnimationSkeleton(const AnimationSkeletonDesc& desc) :
+    m_id(0),
+    m_boneCount(0)
+{
+    Initialize(desc);
+}
+
+void AnimationSkeleton::Initialize(const AnimationSkeletonDesc& desc)
+{
+    if (desc.boneCount > 0 && !desc.parents)
+        throw std::invalid_argument("Skeleton requires parent indices");
+
+    m_id = ++s_skeletonId;
+    m_boneCount = desc.boneCount;
+
+    m_parents.resize(m_boneCount);
+    m_order.resize(m_boneCount);
+
+    bool sorted = true;
+    for (size_t j = 0; j < m_boneCount; ++j)
+    {
+        const uint32_t parent = desc.parents[j];
+        if (parent != c_InvalidBone && parent >= m_boneCount)
+            throw std::runtime_error("Model bone has an invalid parent");
+
+        m_parents[j] = parent;
+        m_order[j] = static_cast<uint32_t>(j);
+
+        if (parent != c_InvalidBone && parent >= j)
+            sorted = false;
+    }
+
+    if (!sorted)
+    {
+        // Order the bones by depth in the hierarchy so parents are always evaluated first
+        std::vector<uint32_t> depth(m_boneCount, 0);
+        for (size_t j = 0; j < m_boneCount; ++j)
+        {
+            uint32_t d = 0;
+            for (uint32_t parent = m_parents[j]; parent != c_InvalidBone; parent = m_parents[parent])
+            {
+                if (++d > m_boneCount)
+                    throw std::runtime_error("Model bone hierarchy contains a cycle");
+            }
+            depth[j] = d;
+        }
+
+        std::stable_sort(m_order.begin(), m_order.end(),
+            [&depth](uint32_t a, uint32_t b) { return depth[a] < depth[b]; });
+    }
+
+    if (desc.bindPose)
+    {
+        m_bindMatrices.assign(desc.bindPose, desc.bindPose + m_boneCount);
+    }
+    else
+    {
+        m_bindMatrices.assign(m_boneCount, XMMatrixIdentity());
+    }
+
+    if (desc.invBindPose)
+    {
+        m_invBindPose.assign(desc.invBindPose, desc.invBindPose + m_boneCount);
+    }
+
+    m_bindPose.resize(m_boneCount);
+    for (size_t j = 0; j < m_boneCount; ++j)
+    {
+        auto& bind = m_bindPose[j];
+        if (!XMMatrixDecompose(&bind.scale, &bind.rotation, &bind.translation, m_bindMatrices[j]))
+        {
+            // Bones with shear or zero scale keep just their translation
+            bind.scale = g_XMOne;
+            bind.rotation = XMQuaternionIdentity();
+            bind.translation = m_bindMatrices[j].r[3];
+        }
+    }
+
+    m_boneNames.clear();
+
+    if (desc.names)
+    {
+        m_boneNames.reserve(m_boneCount);
+
+        for (size_t j = 0; j < m_boneCount; ++j)
+        {
+            if (!desc.names[j])
+                continue;
+
+            // First bone wins for duplicate names, which matches the original linear search
+            m_boneNames.emplace(FoldName(desc.names[j]), static_cast<uint32_t>(j));
+        }
+    }
+}
+
+_Use_decl_annotations_
+uint32_t AnimationSkeleton::FindBone(const wchar_t* name) const
+{
+    if (!name)
+        return c_InvalidBone;
+
+    return FindBone(FoldName(name));
+}
+
+uint32_t AnimationSkeleton::FindBone(const std::wstring& foldedName) const
+{
+    auto it = m_boneNames.find(foldedName);
+    return (it != m_boneNames.cend()) ? it->second : c_InvalidBone;
+}
+
+_Use_decl_annotations_
+std::wstring AnimationSkeleton::FoldName(const wchar_t* name)
+{
+    std::wstring result(name);
+    for (auto& c : result)
+    {
+        c = static_cast<wchar_t>(towlower(static_cast<wint_t>(c)));
+    }
+    return result;
+}
+
+namespace
+{
+    // Skinning transforms are only written when requested
+    struct OptionalStore
+    {
+        XMMATRIX* boneTransforms;
+
+        void XM_CALLCONV operator()(size_t j, FXMMATRIX m) const noexcept
+        {
+            if (boneTransforms)
+            {
+                boneTransforms[j] = m;
+            }
+        }
+    };
+
+    const XMMATRIX* GetInvBindPose(const AnimationSkeleton& skeleton, const XMMATRIX* boneTransforms)
+    {
+        const XMMATRIX* invBindPose = skeleton.GetInvBindPose();
+        if (!invBindPose)
+        {
+            if (boneTransforms)
+                throw std::invalid_argument("Skinning transforms require the inverse bind pose");
+
+            // Only absolute transforms are wanted, so the bind pose stands in to keep the sweep simple
+            invBindPose = skeleton.GetBindPoseMatrices();
+        }
+        return invBindPose;
+    }
+}
+
+_Use_decl_annotations_
+void DX::EvaluatePose(
+    const AnimationSkeleton& skeleton,
+    const AnimationLocalTransform* localPose,
+    XMMATRIX* absolute,
+    XMMATRIX* boneTransforms)
+{
+    if (!localPose || !absolute)
+        throw std::invalid_argument("Local pose and absolute transforms array required");
+
+    EvaluatePose(skeleton, GetInvBindPose(skeleton, boneTransforms),
+        [=](uint32_t j) -> XMMATRIX
+        {
+            return ComposeLocalTransform(localPose[j].scale, localPose[j].rotation, localPose[j].translation);
+        },
+        absolute, OptionalStore{ boneTransforms });
+}
+
+_Use_decl_annotations_
+void DX::EvaluatePose(
+    const AnimationSkeleton& skeleton,
+    const XMMATRIX* localTransforms,
+    XMMATRIX* absolute,
+    XMMATRIX* boneTransforms)
+{
+    if (!localTransforms || !absolute)
+        throw std::invalid_argument("Local transforms and absolute transforms array required");
+
+    EvaluatePose(skeleton, GetInvBindPose(skeleton, boneTransforms),
+        [=](uint32_t j) -> XMMATRIX { return localTransforms[j]; },
+        absolute, OptionalStore{ boneTransforms });
+}
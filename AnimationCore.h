@@ -0,0 +1,182 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationCore.h
+//
+// Skeleton and pose evaluation shared by the animation playback classes. This only
+// depends on DirectXMath, so it also builds without the Windows SDK or Direct3D, for
+// example to evaluate hitboxes on a dedicated server.
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <DirectXMath.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace DirectX
+{
+    class Model;
+}
+
+namespace DX
+{
+    // Local bone transform kept as separate components so poses can be blended before the hierarchy pass
+    struct AnimationLocalTransform
+    {
+        DirectX::XMVECTOR   scale;
+        DirectX::XMVECTOR   rotation;
+        DirectX::XMVECTOR   translation;
+    };
+
+    // Plain skeleton description. Only the parents are required.
+    struct AnimationSkeletonDesc
+    {
+        size_t                          boneCount;
+        const uint32_t*                 parents;        // AnimationSkeleton::c_InvalidBone for roots
+        const DirectX::XMMATRIX*        bindPose;       // Local bind pose transforms, or identity if null
+        const DirectX::XMMATRIX*        invBindPose;    // Required to compute skinning transforms
+        const wchar_t* const*           names;          // Optional, for FindBone
+    };
+
+    // Skeleton description built once per model, with a case-insensitive hashed bone name index
+    class AnimationSkeleton
+    {
+    public:
+        // Same value as DirectX::ModelBone::c_Invalid
+        static constexpr uint32_t c_InvalidBone = uint32_t(-1);
+
+        explicit AnimationSkeleton(const AnimationSkeletonDesc& desc);
+
+        // Defined with the playback classes in Animation.cpp
+        explicit AnimationSkeleton(const DirectX::Model& model);
+
+        ~AnimationSkeleton() = default;
+
+        AnimationSkeleton(AnimationSkeleton&&) = default;
+        AnimationSkeleton& operator= (AnimationSkeleton&&) = default;
+
+        AnimationSkeleton(AnimationSkeleton const&) = delete;
+        AnimationSkeleton& operator= (AnimationSkeleton const&) = delete;
+
+        // Returns c_InvalidBone if there is no bone with this name
+        uint32_t FindBone(_In_z_ const wchar_t* name) const;
+        uint32_t FindBone(const std::wstring& foldedName) const;
+
+        size_t GetBoneCount() const noexcept { return m_boneCount; }
+
+        // Parent bone index for each bone (c_InvalidBone for roots)
+        const uint32_t* GetParents() const noexcept { return m_parents.data(); }
+
+        // Bone indices ordered so that every parent comes before its children
+        const uint32_t* GetEvaluationOrder() const noexcept { return m_order.data(); }
+
+        // Unique for the lifetime of the process, used as the key for cached bindings
+        uint64_t GetId() const noexcept { return m_id; }
+
+        // Bind pose local transforms, and the same decomposed once as the starting pose for blending
+        const DirectX::XMMATRIX* GetBindPoseMatrices() const noexcept { return m_bindMatrices.data(); }
+        const AnimationLocalTransform* GetBindPose() const noexcept { return m_bindPose.data(); }
+
+        // nullptr if the description didn't include the inverse bind pose
+        const DirectX::XMMATRIX* GetInvBindPose() const noexcept { return m_invBindPose.empty() ? nullptr : m_invBindPose.data(); }
+
+        static std::wstring FoldName(_In_z_ const wchar_t* name);
+
+    private:
+        void Initialize(const AnimationSkeletonDesc& desc);
+
+        uint64_t                                    m_id;
+        size_t                                      m_boneCount;
+        std::vector<uint32_t>                       m_parents;
+        std::vector<uint32_t>                       m_order;
+        std::vector<DirectX::XMMATRIX>              m_bindMatrices;
+        std::vector<DirectX::XMMATRIX>              m_invBindPose;
+        std::vector<AnimationLocalTransform>        m_bindPose;
+        std::unordered_map<std::wstring, uint32_t>  m_boneNames;
+    };
+
+    inline DirectX::XMMATRIX XM_CALLCONV ComposeLocalTransform(
+        DirectX::FXMVECTOR scale,
+        DirectX::FXMVECTOR rotation,
+        DirectX::FXMVECTOR translation) noexcept
+    {
+        using namespace DirectX;
+        return XMMatrixMultiply(
+            XMMatrixMultiply(XMMatrixScalingFromVector(scale), XMMatrixRotationQuaternion(rotation)),
+            XMMatrixTranslationFromVector(translation));
+    }
+
+    // Lerps scale and translation, and nlerps rotation after flipping its sign onto the same hemisphere
+    // as the pose so the blend takes the shortest path. A weight of 1 replaces the pose.
+    inline void XM_CALLCONV BlendLocalTransform(
+        AnimationLocalTransform& pose,
+        DirectX::FXMVECTOR scale,
+        DirectX::FXMVECTOR rotation,
+        DirectX::FXMVECTOR translation,
+        float weight) noexcept
+    {
+        using namespace DirectX;
+
+        const XMVECTOR w = XMVectorReplicate(weight);
+
+        const XMVECTOR flip = XMVectorLess(XMVector4Dot(pose.rotation, rotation), XMVectorZero());
+        const XMVECTOR q = XMVectorSelect(rotation, XMVectorNegate(rotation), flip);
+
+        pose.rotation = XMQuaternionNormalize(XMVectorLerpV(pose.rotation, q, w));
+        pose.scale = XMVectorLerpV(pose.scale, scale, w);
+        pose.translation = XMVectorLerpV(pose.translation, translation, w);
+    }
+
+    // Computes local, absolute, and skinning transforms for each bone in a single sweep. getLocal(j) returns
+    // the local transform for bone j, and store(j, m) receives its skinning transform.
+    template<typename TLocal, typename TStore>
+    void EvaluatePose(
+        const AnimationSkeleton& skeleton,
+        _In_reads_(skeleton.GetBoneCount()) const DirectX::XMMATRIX* invBindPose,
+        TLocal&& getLocal,
+        _Out_writes_(skeleton.GetBoneCount()) DirectX::XMMATRIX* absolute,
+        TStore&& store)
+    {
+        using namespace DirectX;
+
+        const uint32_t* order = skeleton.GetEvaluationOrder();
+        const uint32_t* parents = skeleton.GetParents();
+
+        const size_t nbones = skeleton.GetBoneCount();
+        for (size_t k = 0; k < nbones; ++k)
+        {
+            const uint32_t j = order[k];
+
+            XMMATRIX m = getLocal(j);
+
+            const uint32_t parent = parents[j];
+            if (parent != AnimationSkeleton::c_InvalidBone)
+            {
+                m = XMMatrixMultiply(m, absolute[parent]);
+            }
+
+            absolute[j] = m;
+            store(j, XMMatrixMultiply(invBindPose[j], m));
+        }
+    }
+
+    // Evaluates a local pose, such as the result of blending. The skinning transforms are optional, which is
+    // all that is needed for hitboxes, and require the skeleton's inverse bind pose.
+    void EvaluatePose(
+        const AnimationSkeleton& skeleton,
+        _In_reads_(skeleton.GetBoneCount()) const AnimationLocalTransform* localPose,
+        _Out_writes_(skeleton.GetBoneCount()) DirectX::XMMATRIX* absolute,
+        _Out_writes_opt_(skeleton.GetBoneCount()) DirectX::XMMATRIX* boneTransforms = nullptr);
+
+    void EvaluatePose(
+        const AnimationSkeleton& skeleton,
+        _In_reads_(skeleton.GetBoneCount()) const DirectX::XMMATRIX* localTransforms,
+        _Out_writes_(skeleton.GetBoneCount()) DirectX::XMMATRIX* absolute,
+        _Out_writes_opt_(skeleton.GetBoneCount()) DirectX::XMMATRIX* boneTransforms = nullptr);
+}
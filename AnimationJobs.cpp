@@ -0,0 +1,240 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationJobs.cpp
+//
+// Work-stealing job system for evaluating many animation instances across all cores
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "AnimationJobs.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace DX;
+using namespace DirectX;
+
+AnimationJobSystem::AnimationJobSystem(size_t workerCount) :
+    m_generation(0),
+    m_shutdown(false),
+    m_pending(0),
+    m_func(nullptr)
+{
+    if (!workerCount)
+    {
+        const unsigned int hw = std::thread::hardware_concurrency();
+        workerCount = (hw > 1) ? size_t(hw - 1) : 0;
+    }
+
+    // Queue 0 belongs to the calling thread
+    m_queues.reserve(workerCount + 1);
+    for (size_t j = 0; j <= workerCount; ++j)
+    {
+        m_queues.emplace_back(std::make_unique<WorkQueue>());
+    }
+
+    m_threads.reserve(workerCount);
+    for (size_t j = 1; j <= workerCount; ++j)
+    {
+        m_threads.emplace_back(&AnimationJobSystem::WorkerThread, this, j);
+    }
+}
+
+AnimationJobSystem::~AnimationJobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        m_shutdown = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& it : m_threads)
+    {
+        it.join();
+    }
+}
+
+void AnimationJobSystem::ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& func)
+{
+    m_timings.clear();
+
+    if (!count)
+        return;
+
+    if (!func)
+    {
+        throw std::invalid_argument("Job function required");
+    }
+
+    grainSize = std::max<size_t>(1, grainSize);
+    const size_t jobCount = (count + grainSize - 1) / grainSize;
+
+    m_func = &func;
+    m_error = nullptr;
+    m_start = std::chrono::steady_clock::now();
+    m_pending.store(jobCount);
+
+    // Deal the jobs out round-robin, idle threads will steal from the busy ones
+    const size_t nqueues = m_queues.size();
+    for (size_t q = 0; q < nqueues; ++q)
+    {
+        auto& queue = *m_queues[q];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.timings.clear();
+
+        for (size_t j = q; j < jobCount; j += nqueues)
+        {
+            const size_t first = j * grainSize;
+            queue.jobs.push_back(Job{ static_cast<uint32_t>(j), first, std::min(grainSize, count - first) });
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    // The calling thread works too rather than waiting
+    while (m_pending.load(std::memory_order_acquire) > 0)
+    {
+        if (!RunJob(0))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    m_func = nullptr;
+
+    for (auto& it : m_queues)
+    {
+        std::lock_guard<std::mutex> lock(it->lock);
+        m_timings.insert(m_timings.end(), it->timings.cbegin(), it->timings.cend());
+    }
+
+    std::sort(m_timings.begin(), m_timings.end(),
+        [](const JobTiming& a, const JobTiming& b) { return a.jobIndex < b.jobIndex; });
+
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+_Use_decl_annotations_
+void AnimationJobSystem::ApplyBatch(
+    const Model& model,
+    size_t nbones,
+    const AnimationSDKMESH::BatchItem* items,
+    size_t count,
+    size_t grainSize)
+{
+    if (count > 0 && !items)
+    {
+        throw std::invalid_argument("Batch items required");
+    }
+
+    ParallelFor(count, grainSize, [&](size_t first, size_t n)
+        {
+            AnimationSDKMESH::ApplyBatch(model, nbones, items + first, n);
+        });
+}
+
+void AnimationJobSystem::WorkerThread(size_t threadIndex)
+{
+    uint64_t generation = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_wakeLock);
+            m_wake.wait(lock, [&] { return m_shutdown || m_generation != generation; });
+
+            if (m_shutdown)
+                return;
+
+            generation = m_generation;
+        }
+
+        while (m_pending.load(std::memory_order_acquire) > 0)
+        {
+            if (!RunJob(threadIndex))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+// Takes the newest job from this thread's own queue, or steals the oldest job from another thread
+bool AnimationJobSystem::RunJob(size_t threadIndex)
+{
+    Job job = {};
+    bool found = false;
+
+    {
+        auto& queue = *m_queues[threadIndex];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (!queue.jobs.empty())
+        {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+            found = true;
+        }
+    }
+
+    const size_t nqueues = m_queues.size();
+    for (size_t j = 1; !found && j < nqueues; ++j)
+    {
+        auto& victim = *m_queues[(threadIndex + j) % nqueues];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            found = true;
+        }
+    }
+
+    if (!found)
+        return false;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    try
+    {
+        (*m_func)(job.first, job.count);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_errorLock);
+        if (!m_error)
+        {
+            m_error = std::current_exception();
+        }
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+
+    using ms = std::chrono::duration<float, std::milli>;
+
+    JobTiming timing = {};
+    timing.threadIndex = static_cast<uint32_t>(threadIndex);
+    timing.jobIndex = job.index;
+    timing.first = job.first;
+    timing.count = job.count;
+    timing.startMs = ms(start - m_start).count();
+    timing.durationMs = ms(end - start).count();
+
+    {
+        auto& queue = *m_queues[threadIndex];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.timings.push_back(timing);
+    }
+
+    m_pending.fetch_sub(1, std::memory_order_release);
+
+    return true;
+}
@@ -0,0 +1,102 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationJobs.h
+//
+// Work-stealing job system for evaluating many animation instances across all cores
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "Animation.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace DX
+{
+    class AnimationJobSystem
+    {
+    public:
+        // A worker count of 0 uses one worker per hardware thread, less the calling thread
+        explicit AnimationJobSystem(size_t workerCount = 0);
+        ~AnimationJobSystem();
+
+        AnimationJobSystem(AnimationJobSystem&&) = delete;
+        AnimationJobSystem& operator= (AnimationJobSystem&&) = delete;
+
+        AnimationJobSystem(AnimationJobSystem const&) = delete;
+        AnimationJobSystem& operator= (AnimationJobSystem const&) = delete;
+
+        struct JobTiming
+        {
+            uint32_t    threadIndex;    // 0 is the calling thread
+            uint32_t    jobIndex;
+            size_t      first;
+            size_t      count;
+            float       startMs;        // Relative to the start of the ParallelFor call
+            float       durationMs;
+        };
+
+        // Splits [0, count) into jobs of up to grainSize items and runs them on all threads,
+        // including the calling thread. Blocks until every job has finished.
+        void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t first, size_t count)>& func);
+
+        // Evaluates a frame's SDKMESH instances, which must share the same clip and skeleton
+        void ApplyBatch(
+            const DirectX::Model& model,
+            size_t nbones,
+            _In_reads_(count) const AnimationSDKMESH::BatchItem* items,
+            size_t count,
+            size_t grainSize = 32);
+
+        // Timings for each job of the last ParallelFor or ApplyBatch call
+        const std::vector<JobTiming>& GetTimings() const noexcept { return m_timings; }
+
+        size_t GetThreadCount() const noexcept { return m_queues.size(); }
+
+    private:
+        struct Job
+        {
+            uint32_t    index;
+            size_t      first;
+            size_t      count;
+        };
+
+        struct WorkQueue
+        {
+            std::mutex              lock;
+            std::deque<Job>         jobs;
+            std::vector<JobTiming>  timings;
+        };
+
+        void WorkerThread(size_t threadIndex);
+        bool RunJob(size_t threadIndex);
+
+        std::vector<std::unique_ptr<WorkQueue>>             m_queues;
+        std::vector<std::thread>                            m_threads;
+
+        std::mutex                                          m_wakeLock;
+        std::condition_variable                             m_wake;
+        uint64_t                                            m_generation;
+        bool                                                m_shutdown;
+
+        std::atomic<size_t>                                 m_pending;
+        const std::function<void(size_t, size_t)>*          m_func;
+        std::chrono::steady_clock::time_point               m_start;
+
+        std::mutex                                          m_errorLock;
+        std::exception_ptr                                  m_error;
+
+        std::vector<JobTiming>                              m_timings;
+    };
+}
@@ -0,0 +1,194 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationLOD.cpp
+//
+// Distance-based level of detail for SDKMESH and CMO animation playback
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "AnimationLOD.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace DX;
+using namespace DirectX;
+
+_Use_decl_annotations_
+AnimationLOD::AnimationLOD(const Model& model, const Level* levels, size_t count) :
+    m_boneCount(model.bones.size()),
+    m_culled(0),
+    m_nextPhase(0),
+    m_frame(0)
+{
+    if (!count || !levels)
+    {
+        throw std::invalid_argument("At least one level required");
+    }
+
+    // Height of each bone above the deepest bone below it, so leaves are 0 and their parents 1
+    std::vector<uint32_t> height(m_boneCount, 0);
+    for (size_t j = 0; j < m_boneCount; ++j)
+    {
+        uint32_t h = 0;
+        for (uint32_t parent = model.bones[j].parentIndex; parent != ModelBone::c_Invalid; parent = model.bones[parent].parentIndex)
+        {
+            if (parent >= m_boneCount || ++h > m_boneCount)
+                throw std::runtime_error("Model bone hierarchy is invalid");
+
+            height[parent] = std::max(height[parent], h);
+        }
+    }
+
+    m_levels.resize(count);
+    for (size_t j = 0; j < count; ++j)
+    {
+        auto& level = m_levels[j];
+        level.desc = levels[j];
+        level.desc.updateInterval = std::max(1u, level.desc.updateInterval);
+
+        level.boneMask.resize(m_boneCount);
+        level.activeBones = 0;
+        for (size_t k = 0; k < m_boneCount; ++k)
+        {
+            const bool active = (height[k] >= level.desc.leafDepth);
+            level.boneMask[k] = active ? 1 : 0;
+            level.activeBones += active ? 1 : 0;
+        }
+    }
+
+    std::stable_sort(m_levels.begin(), m_levels.end(),
+        [](const LevelData& a, const LevelData& b) { return a.desc.distance < b.desc.distance; });
+
+    m_counters = std::make_unique<Counters[]>(count);
+    BeginFrame();
+}
+
+void AnimationLOD::BeginFrame() noexcept
+{
+    ++m_frame;
+
+    for (size_t j = 0; j < m_levels.size(); ++j)
+    {
+        m_counters[j].instances.store(0, std::memory_order_relaxed);
+        m_counters[j].evaluated.store(0, std::memory_order_relaxed);
+        m_counters[j].reused.store(0, std::memory_order_relaxed);
+        m_counters[j].bonesEvaluated.store(0, std::memory_order_relaxed);
+        m_counters[j].bonesSkipped.store(0, std::memory_order_relaxed);
+    }
+
+    m_culled.store(0, std::memory_order_relaxed);
+}
+
+uint32_t AnimationLOD::GetLevel(float distance) const noexcept
+{
+    uint32_t level = 0;
+    while (level + 1 < m_levels.size() && distance >= m_levels[level + 1].desc.distance)
+    {
+        ++level;
+    }
+    return level;
+}
+
+_Use_decl_annotations_
+bool AnimationLOD::Apply(
+    const Model& model,
+    const AnimationSDKMESH& animation,
+    InstanceState& state,
+    float distance,
+    bool visible,
+    size_t nbones,
+    XMMATRIX* boneTransforms)
+{
+    return ApplyInstance(model, animation, state, distance, visible, nbones, boneTransforms);
+}
+
+_Use_decl_annotations_
+bool AnimationLOD::Apply(
+    const Model& model,
+    const AnimationCMO& animation,
+    InstanceState& state,
+    float distance,
+    bool visible,
+    size_t nbones,
+    XMMATRIX* boneTransforms)
+{
+    return ApplyInstance(model, animation, state, distance, visible, nbones, boneTransforms);
+}
+
+template<typename TAnimation>
+bool AnimationLOD::ApplyInstance(
+    const Model& model,
+    const TAnimation& animation,
+    InstanceState& state,
+    float distance,
+    bool visible,
+    size_t nbones,
+    XMMATRIX* boneTransforms)
+{
+    if (model.bones.size() != m_boneCount)
+    {
+        throw std::invalid_argument("Model does not match the LOD bone masks");
+    }
+
+    if (!visible)
+    {
+        // The palette goes stale while culled, so it is evaluated again as soon as the instance is visible
+        state.valid = false;
+        m_culled.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (!state.started)
+    {
+        // Spread instances sharing an update interval across different frames
+        state.phase = m_nextPhase.fetch_add(1, std::memory_order_relaxed);
+        state.started = true;
+    }
+
+    const uint32_t level = GetLevel(distance);
+    const auto& data = m_levels[level];
+    auto& counters = m_counters[level];
+
+    counters.instances.fetch_add(1, std::memory_order_relaxed);
+
+    const bool due = !state.valid
+        || state.level != level
+        || ((m_frame + state.phase) % data.desc.updateInterval) == 0;
+
+    if (!due)
+    {
+        counters.reused.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const uint8_t* boneMask = (data.activeBones < m_boneCount) ? data.boneMask.data() : nullptr;
+
+    animation.Apply(model, nbones, boneTransforms, boneMask);
+
+    state.level = level;
+    state.valid = true;
+
+    // Bones without keys, and every bone with baked palettes, aren't sampled even when the mask is set
+    const size_t sampled = animation.GetSampledBoneCount(boneMask);
+
+    counters.evaluated.fetch_add(1, std::memory_order_relaxed);
+    counters.bonesEvaluated.fetch_add(sampled, std::memory_order_relaxed);
+    counters.bonesSkipped.fetch_add(m_boneCount - sampled, std::memory_order_relaxed);
+    return true;
+}
+
+AnimationLOD::Stats AnimationLOD::GetStats(uint32_t level) const noexcept
+{
+    const auto& counters = m_counters[level];
+
+    Stats stats = {};
+    stats.instances = counters.instances.load(std::memory_order_relaxed);
+    stats.evaluated = counters.evaluated.load(std::memory_order_relaxed);
+    stats.reused = counters.reused.load(std::memory_order_relaxed);
+    stats.bonesEvaluated = counters.bonesEvaluated.load(std::memory_order_relaxed);
+    stats.bonesSkipped = counters.bonesSkipped.load(std::memory_order_relaxed);
+    return stats;
+}
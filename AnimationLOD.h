@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationLOD.h
+//
+// Distance-based level of detail for SDKMESH and CMO animation playback
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "Animation.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace DX
+{
+    class AnimationLOD
+    {
+    public:
+        struct Level
+        {
+            float       distance;           // The level is used from this distance outward
+            uint32_t    updateInterval;     // Evaluates every Nth frame, reusing the previous palette in between
+            uint32_t    leafDepth;          // Bones within this many steps of the end of a chain use the bind pose
+        };
+
+        struct Stats
+        {
+            uint32_t    instances;          // Visible instances at this level
+            uint32_t    evaluated;          // Instances whose palette was written this frame
+            uint32_t    reused;             // Instances which kept the palette from an earlier frame
+            uint64_t    bonesEvaluated;     // Bones sampled from the clip, summed over the evaluated instances
+            uint64_t    bonesSkipped;       // Bones which used the bind pose or a baked palette instead
+        };
+
+        // Kept alongside each playback instance and its palette
+        struct InstanceState
+        {
+            uint32_t    phase = 0;
+            uint32_t    level = 0;
+            bool        started = false;
+            bool        valid = false;      // The palette holds a pose from an earlier frame
+        };
+
+        // Levels are sorted by distance. A single level of { 0, 1, 0 } evaluates everything every frame.
+        AnimationLOD(const DirectX::Model& model, _In_reads_(count) const Level* levels, size_t count);
+        ~AnimationLOD() = default;
+
+        AnimationLOD(AnimationLOD&&) = delete;
+        AnimationLOD& operator= (AnimationLOD&&) = delete;
+
+        AnimationLOD(AnimationLOD const&) = delete;
+        AnimationLOD& operator= (AnimationLOD const&) = delete;
+
+        // Advances the frame and clears the statistics
+        void BeginFrame() noexcept;
+
+        uint32_t GetLevel(float distance) const noexcept;
+
+        // Writes the palette if the instance is due this frame, otherwise leaves the previous palette in place.
+        // Culled instances are never evaluated, and are evaluated as soon as they are visible again or move
+        // to a different level. Returns true if the palette was written. Can be called concurrently for
+        // different instances.
+        bool Apply(
+            const DirectX::Model& model,
+            const AnimationSDKMESH& animation,
+            InstanceState& state,
+            float distance,
+            bool visible,
+            size_t nbones,
+            _Out_writes_(nbones) DirectX::XMMATRIX* boneTransforms);
+
+        bool Apply(
+            const DirectX::Model& model,
+            const AnimationCMO& animation,
+            InstanceState& state,
+            float distance,
+            bool visible,
+            size_t nbones,
+            _Out_writes_(nbones) DirectX::XMMATRIX* boneTransforms);
+
+        uint32_t GetLevelCount() const noexcept { return static_cast<uint32_t>(m_levels.size()); }
+        const Level& GetLevelDesc(uint32_t level) const noexcept { return m_levels[level].desc; }
+
+        // Mask passed to Apply for the level, 1 for bones which are sampled
+        const uint8_t* GetBoneMask(uint32_t level) const noexcept { return m_levels[level].boneMask.data(); }
+
+        Stats GetStats(uint32_t level) const noexcept;
+        uint32_t GetCulledCount() const noexcept { return m_culled.load(std::memory_order_relaxed); }
+
+    private:
+        struct LevelData
+        {
+            Level                   desc;
+            std::vector<uint8_t>    boneMask;
+            uint32_t                activeBones;
+        };
+
+        struct Counters
+        {
+            std::atomic<uint32_t>   instances;
+            std::atomic<uint32_t>   evaluated;
+            std::atomic<uint32_t>   reused;
+            std::atomic<uint64_t>   bonesEvaluated;
+            std::atomic<uint64_t>   bonesSkipped;
+        };
+
+        template<typename TAnimation>
+        bool ApplyInstance(
+            const DirectX::Model& model,
+            const TAnimation& animation,
+            InstanceState& state,
+            float distance,
+            bool visible,
+            size_t nbones,
+            DirectX::XMMATRIX* boneTransforms);
+
+        size_t                      m_boneCount;
+        std::vector<LevelData>      m_levels;
+        std::unique_ptr<Counters[]> m_counters;
+        std::atomic<uint32_t>       m_culled;
+        std::atomic<uint32_t>       m_nextPhase;
+        uint64_t                    m_frame;
+    };
+}
@@ -8,138 +8,717 @@
 #include "pch.h"
 #include "DebugDraw.h"
 
+#include "BufferHelpers.h"
+
+#include <DirectXPackedVector.h>
+
 #include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
 
 using namespace DirectX;
 
 namespace
 {
-    inline void XM_CALLCONV DrawCube(PrimitiveBatch<VertexPositionColor>* batch,
+    // Appends to a recorder's line list in place of a PrimitiveBatch, converting strips to lists
+    class LineListWriter
+    {
+    public:
+        explicit LineListWriter(std::vector<VertexPositionColor>& lines) noexcept :
+            m_lines(lines)
+        {
+        }
+
+        void Draw(D3D_PRIMITIVE_TOPOLOGY topology, const VertexPositionColor* verts, size_t count)
+        {
+            if (topology == D3D_PRIMITIVE_TOPOLOGY_LINESTRIP)
+            {
+                for (size_t j = 1; j < count; ++j)
+                {
+                    m_lines.push_back(verts[j - 1]);
+                    m_lines.push_back(verts[j]);
+                }
+            }
+            else
+            {
+                assert(topology == D3D_PRIMITIVE_TOPOLOGY_LINELIST);
+                m_lines.insert(m_lines.end(), verts, verts + count);
+            }
+        }
+
+        void DrawIndexed(D3D_PRIMITIVE_TOPOLOGY topology,
+            const uint16_t* indices, size_t indexCount,
+            const VertexPositionColor* verts, size_t)
+        {
+            assert(topology == D3D_PRIMITIVE_TOPOLOGY_LINELIST);
+            UNREFERENCED_PARAMETER(topology);
+
+            for (size_t j = 0; j < indexCount; ++j)
+            {
+                m_lines.push_back(verts[indices[j]]);
+            }
+        }
+
+        void DrawLine(const VertexPositionColor& v1, const VertexPositionColor& v2)
+        {
+            m_lines.push_back(v1);
+            m_lines.push_back(v2);
+        }
+
+    private:
+        std::vector<VertexPositionColor>& m_lines;
+    };
+
+    // Vertex type written for each kind of output
+    template<typename TBatch> struct BatchVertex;
+
+    template<typename TVertex> struct BatchVertex<PrimitiveBatch<TVertex>> { using type = TVertex; };
+    template<> struct BatchVertex<LineListWriter> { using type = VertexPositionColor; };
+
+    // Each shape converts its color once and copies it to every vertex
+    inline void XM_CALLCONV StoreColor(XMFLOAT4& dest, FXMVECTOR color) noexcept
+    {
+        XMStoreFloat4(&dest, color);
+    }
+
+    inline void XM_CALLCONV StoreColor(uint32_t& dest, FXMVECTOR color) noexcept
+    {
+        PackedVector::XMUBYTEN4 packed;
+        PackedVector::XMStoreUByteN4(&packed, color);
+        dest = packed.v;
+    }
+
+    std::atomic<uint64_t> s_recorderId(0);
+
+    // Ids of the recorders which still exist, and a count of destroyed ones so each thread can tell when
+    // it has entries to prune
+    std::mutex s_recorderLock;
+    std::vector<uint64_t> s_liveRecorders;
+    std::atomic<uint64_t> s_recorderGeneration(0);
+
+    constexpr size_t c_ringSegments = DX::DebugDrawView::c_maxRingSegments;
+
+    // Spheres needing this few ring segments are drawn as just their outline
+    constexpr size_t c_silhouetteSegments = 8;
+
+    const XMVECTORF32 s_cubeVerts[8] =
+    {
+        { { { -1.f, -1.f, -1.f, 0.f } } },
+        { { {  1.f, -1.f, -1.f, 0.f } } },
+        { { {  1.f, -1.f,  1.f, 0.f } } },
+        { { { -1.f, -1.f,  1.f, 0.f } } },
+        { { { -1.f,  1.f, -1.f, 0.f } } },
+        { { {  1.f,  1.f, -1.f, 0.f } } },
+        { { {  1.f,  1.f,  1.f, 0.f } } },
+        { { { -1.f,  1.f,  1.f, 0.f } } }
+    };
+
+    const uint16_t s_cubeIndices[] =
+    {
+        0, 1,
+        1, 2,
+        2, 3,
+        3, 0,
+        4, 5,
+        5, 6,
+        6, 7,
+        7, 4,
+        0, 4,
+        1, 5,
+        2, 6,
+        3, 7
+    };
+
+    template<typename TBatch>
+    void XM_CALLCONV CubeLines(TBatch* batch,
         CXMMATRIX matWorld,
         FXMVECTOR color)
     {
-        static const XMVECTORF32 s_verts[8] =
-        {
-            { { { -1.f, -1.f, -1.f, 0.f } } },
-            { { {  1.f, -1.f, -1.f, 0.f } } },
-            { { {  1.f, -1.f,  1.f, 0.f } } },
-            { { { -1.f, -1.f,  1.f, 0.f } } },
-            { { { -1.f,  1.f, -1.f, 0.f } } },
-            { { {  1.f,  1.f, -1.f, 0.f } } },
-            { { {  1.f,  1.f,  1.f, 0.f } } },
-            { { { -1.f,  1.f,  1.f, 0.f } } }
-        };
+        using TVertex = typename BatchVertex<TBatch>::type;
 
-        static const WORD s_indices[] =
-        {
-            0, 1,
-            1, 2,
-            2, 3,
-            3, 0,
-            4, 5,
-            5, 6,
-            6, 7,
-            7, 4,
-            0, 4,
-            1, 5,
-            2, 6,
-            3, 7
-        };
+        decltype(TVertex::color) vertexColor;
+        StoreColor(vertexColor, color);
 
-        VertexPositionColor verts[8];
+        TVertex verts[8];
         for (size_t i = 0; i < 8; ++i)
         {
-            const XMVECTOR v = XMVector3Transform(s_verts[i], matWorld);
+            const XMVECTOR v = XMVector3Transform(s_cubeVerts[i], matWorld);
             XMStoreFloat3(&verts[i].position, v);
-            XMStoreFloat4(&verts[i].color, color);
+            verts[i].color = vertexColor;
+        }
+
+        batch->DrawIndexed(D3D_PRIMITIVE_TOPOLOGY_LINELIST, s_cubeIndices, static_cast<UINT>(std::size(s_cubeIndices)), verts, 8);
+    }
+
+    template<typename TBatch>
+    void XM_CALLCONV BoxLines(TBatch* batch,
+        const BoundingBox& box,
+        FXMVECTOR color)
+    {
+        XMMATRIX matWorld = XMMatrixScaling(box.Extents.x, box.Extents.y, box.Extents.z);
+        const XMVECTOR position = XMLoadFloat3(&box.Center);
+        matWorld.r[3] = XMVectorSelect(matWorld.r[3], position, g_XMSelect1110);
+
+        CubeLines(batch, matWorld, color);
+    }
+
+    template<typename TBatch>
+    void XM_CALLCONV BoxLines(TBatch* batch,
+        const BoundingOrientedBox& obb,
+        FXMVECTOR color)
+    {
+        XMMATRIX matWorld = XMMatrixRotationQuaternion(XMLoadFloat4(&obb.Orientation));
+        const XMMATRIX matScale = XMMatrixScaling(obb.Extents.x, obb.Extents.y, obb.Extents.z);
+        matWorld = XMMatrixMultiply(matScale, matWorld);
+        const XMVECTOR position = XMLoadFloat3(&obb.Center);
+        matWorld.r[3] = XMVectorSelect(matWorld.r[3], position, g_XMSelect1110);
+
+        CubeLines(batch, matWorld, color);
+    }
+
+    template<typename TBatch>
+    void XM_CALLCONV FrustumLines(TBatch* batch,
+        const BoundingFrustum& frustum,
+        FXMVECTOR color)
+    {
+        XMFLOAT3 corners[BoundingFrustum::CORNER_COUNT];
+        frustum.GetCorners(corners);
+
+        using TVertex = typename BatchVertex<TBatch>::type;
+
+        TVertex verts[24] = {};
+        verts[0].position = corners[0];
+        verts[1].position = corners[1];
+        verts[2].position = corners[1];
+        verts[3].position = corners[2];
+        verts[4].position = corners[2];
+        verts[5].position = corners[3];
+        verts[6].position = corners[3];
+        verts[7].position = corners[0];
+
+        verts[8].position = corners[0];
+        verts[9].position = corners[4];
+        verts[10].position = corners[1];
+        verts[11].position = corners[5];
+        verts[12].position = corners[2];
+        verts[13].position = corners[6];
+        verts[14].position = corners[3];
+        verts[15].position = corners[7];
+
+        verts[16].position = corners[4];
+        verts[17].position = corners[5];
+        verts[18].position = corners[5];
+        verts[19].position = corners[6];
+        verts[20].position = corners[6];
+        verts[21].position = corners[7];
+        verts[22].position = corners[7];
+        verts[23].position = corners[4];
+
+        decltype(TVertex::color) vertexColor;
+        StoreColor(vertexColor, color);
+
+        for (size_t j = 0; j < std::size(verts); ++j)
+        {
+            verts[j].color = vertexColor;
+        }
+
+        batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINELIST, verts, static_cast<UINT>(std::size(verts)));
+    }
+
+    template<typename TBatch>
+    void XM_CALLCONV GridLines(TBatch* batch,
+        FXMVECTOR xAxis,
+        FXMVECTOR yAxis,
+        FXMVECTOR origin,
+        size_t xdivs,
+        size_t ydivs,
+        GXMVECTOR color)
+    {
+        xdivs = std::max<size_t>(1, xdivs);
+        ydivs = std::max<size_t>(1, ydivs);
+
+        // The lines are gathered into line list draws rather than drawn one at a time
+        using TVertex = typename BatchVertex<TBatch>::type;
+
+        constexpr size_t c_gridVerts = 256;
+        TVertex verts[c_gridVerts];
+        size_t count = 0;
+
+        decltype(TVertex::color) lineColor;
+        StoreColor(lineColor, color);
+
+        const auto addLine = [&](FXMVECTOR v1, FXMVECTOR v2)
+            {
+                XMStoreFloat3(&verts[count].position, v1);
+                XMStoreFloat3(&verts[count + 1].position, v2);
+                verts[count].color = verts[count + 1].color = lineColor;
+
+                count += 2;
+                if (count == c_gridVerts)
+                {
+                    batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINELIST, verts, count);
+                    count = 0;
+                }
+            };
+
+        for (size_t i = 0; i <= xdivs; ++i)
+        {
+            float percent = float(i) / float(xdivs);
+            percent = (percent * 2.f) - 1.f;
+            XMVECTOR scale = XMVectorScale(xAxis, percent);
+            scale = XMVectorAdd(scale, origin);
+
+            addLine(XMVectorSubtract(scale, yAxis), XMVectorAdd(scale, yAxis));
+        }
+
+        for (size_t i = 0; i <= ydivs; i++)
+        {
+            FLOAT percent = float(i) / float(ydivs);
+            percent = (percent * 2.f) - 1.f;
+            XMVECTOR scale = XMVectorScale(yAxis, percent);
+            scale = XMVectorAdd(scale, origin);
+
+            addLine(XMVectorSubtract(scale, xAxis), XMVectorAdd(scale, xAxis));
+        }
+
+        if (count > 0)
+        {
+            batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINELIST, verts, count);
+        }
+    }
+
+    template<typename TBatch>
+    void XM_CALLCONV RingLines(TBatch* batch,
+        FXMVECTOR origin,
+        FXMVECTOR majorAxis,
+        FXMVECTOR minorAxis,
+        GXMVECTOR color,
+        size_t segments = c_ringSegments)
+    {
+        assert(segments >= DX::DebugDrawView::c_minRingSegments && segments <= c_ringSegments);
+
+        using TVertex = typename BatchVertex<TBatch>::type;
+
+        decltype(TVertex::color) vertexColor;
+        StoreColor(vertexColor, color);
+
+        TVertex verts[c_ringSegments + 1];
+
+        const float fAngleDelta = XM_2PI / float(segments);
+        // Instead of calling cos/sin for each segment we calculate
+        // the sign of the angle delta and then incrementally calculate sin
+        // and cosine from then on.
+        const XMVECTOR cosDelta = XMVectorReplicate(cosf(fAngleDelta));
+        const XMVECTOR sinDelta = XMVectorReplicate(sinf(fAngleDelta));
+        XMVECTOR incrementalSin = XMVectorZero();
+        static const XMVECTORF32 s_initialCos =
+        {
+            { { 1.f, 1.f, 1.f, 1.f } }
+        };
+        XMVECTOR incrementalCos = s_initialCos.v;
+        for (size_t i = 0; i < segments; i++)
+        {
+            XMVECTOR pos = XMVectorMultiplyAdd(majorAxis, incrementalCos, origin);
+            pos = XMVectorMultiplyAdd(minorAxis, incrementalSin, pos);
+            XMStoreFloat3(&verts[i].position, pos);
+            verts[i].color = vertexColor;
+            // Standard formula to rotate a vector.
+            const XMVECTOR newCos = XMVectorSubtract(XMVectorMultiply(incrementalCos, cosDelta), XMVectorMultiply(incrementalSin, sinDelta));
+            const XMVECTOR newSin = XMVectorAdd(XMVectorMultiply(incrementalCos, sinDelta), XMVectorMultiply(incrementalSin, cosDelta));
+            incrementalCos = newCos;
+            incrementalSin = newSin;
+        }
+        verts[segments] = verts[0];
+
+        batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP, verts, segments + 1);
+    }
+
+    // With a view, the ring segments follow the size on screen, and small spheres draw a single ring
+    // facing the camera since the three rings can't be told apart
+    template<typename TBatch>
+    void XM_CALLCONV SphereLines(TBatch* batch,
+        const BoundingSphere& sphere,
+        FXMVECTOR color,
+        const DX::DebugDrawView* view = nullptr)
+    {
+        const XMVECTOR origin = XMLoadFloat3(&sphere.Center);
+
+        const float radius = sphere.Radius;
+
+        size_t segments = c_ringSegments;
+        if (view)
+        {
+            segments = view->GetRingSegments(origin, radius);
+
+            if (segments <= c_silhouetteSegments)
+            {
+                const XMVECTOR toCamera = XMVector3Normalize(XMVectorSubtract(view->GetEyePosition(), origin));
+
+                XMVECTOR majorAxis = XMVector3Cross(toCamera, g_XMIdentityR1);
+                if (XMVector3Equal(XMVector3LengthSq(majorAxis), g_XMZero))
+                {
+                    majorAxis = XMVector3Cross(toCamera, g_XMIdentityR2);
+                }
+                majorAxis = XMVector3Normalize(majorAxis);
+
+                const XMVECTOR minorAxis = XMVector3Cross(toCamera, majorAxis);
+
+                RingLines(batch, origin, XMVectorScale(majorAxis, radius), XMVectorScale(minorAxis, radius), color, segments);
+                return;
+            }
+        }
+
+        const XMVECTOR xaxis = XMVectorScale(g_XMIdentityR0, radius);
+        const XMVECTOR yaxis = XMVectorScale(g_XMIdentityR1, radius);
+        const XMVECTOR zaxis = XMVectorScale(g_XMIdentityR2, radius);
+
+        RingLines(batch, origin, xaxis, zaxis, color, segments);
+        RingLines(batch, origin, xaxis, yaxis, color, segments);
+        RingLines(batch, origin, yaxis, zaxis, color, segments);
+    }
+
+    template<typename TBatch>
+    void XM_CALLCONV RayLines(TBatch* batch,
+        FXMVECTOR origin,
+        FXMVECTOR direction,
+        bool normalize,
+        FXMVECTOR color)
+    {
+        using TVertex = typename BatchVertex<TBatch>::type;
+
+        TVertex verts[3];
+        XMStoreFloat3(&verts[0].position, origin);
+
+        XMVECTOR normDirection = XMVector3Normalize(direction);
+        XMVECTOR rayDirection = (normalize) ? normDirection : direction;
+
+        XMVECTOR perpVector = XMVector3Cross(normDirection, g_XMIdentityR1);
+
+        if (XMVector3Equal(XMVector3LengthSq(perpVector), g_XMZero))
+        {
+            perpVector = XMVector3Cross(normDirection, g_XMIdentityR2);
+        }
+        perpVector = XMVector3Normalize(perpVector);
+
+        XMStoreFloat3(&verts[1].position, XMVectorAdd(rayDirection, origin));
+        perpVector = XMVectorScale(perpVector, 0.0625f);
+        normDirection = XMVectorScale(normDirection, -0.25f);
+        rayDirection = XMVectorAdd(perpVector, rayDirection);
+        rayDirection = XMVectorAdd(normDirection, rayDirection);
+        XMStoreFloat3(&verts[2].position, XMVectorAdd(rayDirection, origin));
+
+        decltype(TVertex::color) vertexColor;
+        StoreColor(vertexColor, color);
+
+        for (auto& v : verts)
+        {
+            v.color = vertexColor;
+        }
+
+        batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP, verts, 2);
+    }
+
+    template<typename TBatch>
+    void XM_CALLCONV TriangleLines(TBatch* batch,
+        FXMVECTOR pointA,
+        FXMVECTOR pointB,
+        FXMVECTOR pointC,
+        GXMVECTOR color)
+    {
+        using TVertex = typename BatchVertex<TBatch>::type;
+
+        TVertex verts[4];
+        XMStoreFloat3(&verts[0].position, pointA);
+        XMStoreFloat3(&verts[1].position, pointB);
+        XMStoreFloat3(&verts[2].position, pointC);
+        XMStoreFloat3(&verts[3].position, pointA);
+
+        decltype(TVertex::color) vertexColor;
+        StoreColor(vertexColor, color);
+
+        for (auto& v : verts)
+        {
+            v.color = vertexColor;
+        }
+
+        batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP, verts, 4);
+    }
+
+    template<typename TBatch>
+    void XM_CALLCONV QuadLines(TBatch* batch,
+        FXMVECTOR pointA,
+        FXMVECTOR pointB,
+        FXMVECTOR pointC,
+        GXMVECTOR pointD,
+        HXMVECTOR color)
+    {
+        using TVertex = typename BatchVertex<TBatch>::type;
+
+        TVertex verts[5];
+        XMStoreFloat3(&verts[0].position, pointA);
+        XMStoreFloat3(&verts[1].position, pointB);
+        XMStoreFloat3(&verts[2].position, pointC);
+        XMStoreFloat3(&verts[3].position, pointD);
+        XMStoreFloat3(&verts[4].position, pointA);
+
+        decltype(TVertex::color) vertexColor;
+        StoreColor(vertexColor, color);
+
+        for (auto& v : verts)
+        {
+            v.color = vertexColor;
+        }
+
+        batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP, verts, 5);
+    }
+
+    //----------------------------------------------------------------------------------
+    // Bulk drawing
+
+    // The default PrimitiveBatch limits, also used to size the chunks recorded into a line list
+    constexpr size_t c_batchMaxVertices = 4096;
+    constexpr size_t c_batchMaxIndices = 4096 * 3;
+
+    constexpr size_t c_sphereVerts = c_ringSegments * 3;
+
+    // Either one color per shape, or the same color for all of them
+    class ShapeColors
+    {
+    public:
+        explicit ShapeColors(FXMVECTOR color) noexcept :
+            m_colors(nullptr)
+        {
+            XMStoreFloat4(&m_shared, color);
+        }
+
+        explicit ShapeColors(const XMFLOAT4* colors) :
+            m_colors(colors),
+            m_shared{}
+        {
+            if (!colors)
+            {
+                throw std::invalid_argument("Colors required");
+            }
+        }
+
+        const XMFLOAT4& operator[](size_t j) const noexcept { return m_colors ? m_colors[j] : m_shared; }
+
+    private:
+        const XMFLOAT4* m_colors;
+        XMFLOAT4        m_shared;
+    };
+
+    // Unit circles in the XZ, XY, and YZ planes, matching Draw for a single sphere
+    const XMVECTOR* GetSphereRings()
+    {
+        static const std::vector<XMVECTOR> s_rings = []
+            {
+                const XMVECTOR axes[3][2] =
+                {
+                    { g_XMIdentityR0, g_XMIdentityR2 },
+                    { g_XMIdentityR0, g_XMIdentityR1 },
+                    { g_XMIdentityR1, g_XMIdentityR2 },
+                };
+
+                std::vector<XMVECTOR> rings(c_sphereVerts);
+                for (size_t k = 0; k < 3; ++k)
+                {
+                    for (size_t i = 0; i < c_ringSegments; ++i)
+                    {
+                        const float angle = XM_2PI * float(i) / float(c_ringSegments);
+                        rings[k * c_ringSegments + i] = XMVectorAdd(
+                            XMVectorScale(axes[k][0], cosf(angle)),
+                            XMVectorScale(axes[k][1], sinf(angle)));
+                    }
+                }
+                return rings;
+            }();
+
+        return s_rings.data();
+    }
+
+    const uint16_t* GetSphereIndices()
+    {
+        static const std::vector<uint16_t> s_indices = []
+            {
+                std::vector<uint16_t> indices;
+                indices.reserve(c_sphereVerts * 2);
+                for (size_t k = 0; k < 3; ++k)
+                {
+                    for (size_t i = 0; i < c_ringSegments; ++i)
+                    {
+                        indices.push_back(static_cast<uint16_t>(k * c_ringSegments + i));
+                        indices.push_back(static_cast<uint16_t>(k * c_ringSegments + (i + 1) % c_ringSegments));
+                    }
+                }
+                return indices;
+            }();
+
+        return s_indices.data();
+    }
+
+    // Writes the vertices for as many shapes as fit in the batch, then submits them as a single
+    // indexed line list. writeShape(shape, verts) writes the positions for one shape. maxVertices and
+    // maxIndices are the limits the batch was created with, which it only accepts draws smaller than.
+    template<typename TBatch, typename TShape, typename TWriteShape>
+    void ShapeLines(TBatch* batch,
+        const TShape* shapes,
+        size_t count,
+        const ShapeColors& colors,
+        size_t maxVertices,
+        size_t maxIndices,
+        size_t vertsPerShape,
+        const uint16_t* shapeIndices,
+        size_t indicesPerShape,
+        TWriteShape&& writeShape)
+    {
+        if (!count)
+            return;
+
+        if (!shapes)
+        {
+            throw std::invalid_argument("Shapes required");
+        }
+
+        // Indices are 16-bit, so no more vertices than they can address
+        maxVertices = std::min<size_t>((maxVertices > 0) ? maxVertices - 1 : 0, UINT16_MAX + 1);
+        maxIndices = (maxIndices > 0) ? maxIndices - 1 : 0;
+
+        if (maxVertices < vertsPerShape || maxIndices < indicesPerShape)
+        {
+            throw std::invalid_argument("Batch is too small for one shape");
+        }
+
+        const size_t perDraw = std::min(count,
+            std::min(maxVertices / vertsPerShape, maxIndices / indicesPerShape));
+
+        std::vector<uint16_t> indices(perDraw * indicesPerShape);
+        for (size_t k = 0; k < perDraw; ++k)
+        {
+            const auto base = static_cast<uint16_t>(k * vertsPerShape);
+            for (size_t i = 0; i < indicesPerShape; ++i)
+            {
+                indices[k * indicesPerShape + i] = static_cast<uint16_t>(base + shapeIndices[i]);
+            }
+        }
+
+        using TVertex = typename BatchVertex<TBatch>::type;
+
+        std::vector<TVertex> verts(perDraw * vertsPerShape);
+
+        for (size_t first = 0; first < count; first += perDraw)
+        {
+            const size_t n = std::min(perDraw, count - first);
+
+            TVertex* v = verts.data();
+            for (size_t k = 0; k < n; ++k, v += vertsPerShape)
+            {
+                writeShape(shapes[first + k], v);
+
+                decltype(TVertex::color) color;
+                StoreColor(color, XMLoadFloat4(&colors[first + k]));
+                for (size_t i = 0; i < vertsPerShape; ++i)
+                {
+                    v[i].color = color;
+                }
+            }
+
+            batch->DrawIndexed(D3D_PRIMITIVE_TOPOLOGY_LINELIST,
+                indices.data(), n * indicesPerShape, verts.data(), n * vertsPerShape);
         }
+    }
+
+    template<typename TBatch>
+    void BoxLines(TBatch* batch, const BoundingBox* boxes, size_t count, const ShapeColors& colors,
+        size_t maxVertices = c_batchMaxVertices, size_t maxIndices = c_batchMaxIndices)
+    {
+        ShapeLines(batch, boxes, count, colors, maxVertices, maxIndices, 8, s_cubeIndices, std::size(s_cubeIndices),
+            [](const BoundingBox& box, auto* verts)
+            {
+                const XMVECTOR center = XMLoadFloat3(&box.Center);
+                const XMVECTOR extents = XMLoadFloat3(&box.Extents);
+
+                for (size_t i = 0; i < 8; ++i)
+                {
+                    XMStoreFloat3(&verts[i].position, XMVectorMultiplyAdd(s_cubeVerts[i], extents, center));
+                }
+            });
+    }
+
+    template<typename TBatch>
+    void BoxLines(TBatch* batch, const BoundingOrientedBox* boxes, size_t count, const ShapeColors& colors,
+        size_t maxVertices = c_batchMaxVertices, size_t maxIndices = c_batchMaxIndices)
+    {
+        ShapeLines(batch, boxes, count, colors, maxVertices, maxIndices, 8, s_cubeIndices, std::size(s_cubeIndices),
+            [](const BoundingOrientedBox& obb, auto* verts)
+            {
+                XMMATRIX matWorld = XMMatrixRotationQuaternion(XMLoadFloat4(&obb.Orientation));
+                matWorld.r[0] = XMVectorScale(matWorld.r[0], obb.Extents.x);
+                matWorld.r[1] = XMVectorScale(matWorld.r[1], obb.Extents.y);
+                matWorld.r[2] = XMVectorScale(matWorld.r[2], obb.Extents.z);
+                matWorld.r[3] = XMVectorSelect(g_XMIdentityR3, XMLoadFloat3(&obb.Center), g_XMSelect1110);
 
-        batch->DrawIndexed(D3D_PRIMITIVE_TOPOLOGY_LINELIST, s_indices, static_cast<UINT>(std::size(s_indices)), verts, 8);
+                for (size_t i = 0; i < 8; ++i)
+                {
+                    XMStoreFloat3(&verts[i].position, XMVector3Transform(s_cubeVerts[i], matWorld));
+                }
+            });
+    }
+
+    template<typename TBatch>
+    void SphereLines(TBatch* batch, const BoundingSphere* spheres, size_t count, const ShapeColors& colors,
+        size_t maxVertices = c_batchMaxVertices, size_t maxIndices = c_batchMaxIndices)
+    {
+        const XMVECTOR* rings = GetSphereRings();
+
+        ShapeLines(batch, spheres, count, colors, maxVertices, maxIndices, c_sphereVerts, GetSphereIndices(), c_sphereVerts * 2,
+            [rings](const BoundingSphere& sphere, auto* verts)
+            {
+                const XMVECTOR center = XMLoadFloat3(&sphere.Center);
+                const XMVECTOR radius = XMVectorReplicate(sphere.Radius);
+
+                for (size_t i = 0; i < c_sphereVerts; ++i)
+                {
+                    XMStoreFloat3(&verts[i].position, XMVectorMultiplyAdd(rings[i], radius, center));
+                }
+            });
     }
 }
 
+//--------------------------------------------------------------------------------------
+// Drawing to a PrimitiveBatch
+//--------------------------------------------------------------------------------------
+
 void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
     const BoundingSphere& sphere,
     FXMVECTOR color)
 {
-    const XMVECTOR origin = XMLoadFloat3(&sphere.Center);
-
-    const float radius = sphere.Radius;
-
-    const XMVECTOR xaxis = XMVectorScale(g_XMIdentityR0, radius);
-    const XMVECTOR yaxis = XMVectorScale(g_XMIdentityR1, radius);
-    const XMVECTOR zaxis = XMVectorScale(g_XMIdentityR2, radius);
-
-    DrawRing(batch, origin, xaxis, zaxis, color);
-    DrawRing(batch, origin, xaxis, yaxis, color);
-    DrawRing(batch, origin, yaxis, zaxis, color);
+    SphereLines(batch, sphere, color);
 }
 
 void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
     const BoundingBox& box,
     FXMVECTOR color)
 {
-    XMMATRIX matWorld = XMMatrixScaling(box.Extents.x, box.Extents.y, box.Extents.z);
-    const XMVECTOR position = XMLoadFloat3(&box.Center);
-    matWorld.r[3] = XMVectorSelect(matWorld.r[3], position, g_XMSelect1110);
-
-    DrawCube(batch, matWorld, color);
+    BoxLines(batch, box, color);
 }
 
 void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
     const BoundingOrientedBox& obb,
     FXMVECTOR color)
 {
-    XMMATRIX matWorld = XMMatrixRotationQuaternion(XMLoadFloat4(&obb.Orientation));
-    const XMMATRIX matScale = XMMatrixScaling(obb.Extents.x, obb.Extents.y, obb.Extents.z);
-    matWorld = XMMatrixMultiply(matScale, matWorld);
-    const XMVECTOR position = XMLoadFloat3(&obb.Center);
-    matWorld.r[3] = XMVectorSelect(matWorld.r[3], position, g_XMSelect1110);
-
-    DrawCube(batch, matWorld, color);
+    BoxLines(batch, obb, color);
 }
 
 void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
     const BoundingFrustum& frustum,
     FXMVECTOR color)
 {
-    XMFLOAT3 corners[BoundingFrustum::CORNER_COUNT];
-    frustum.GetCorners(corners);
-
-    VertexPositionColor verts[24] = {};
-    verts[0].position = corners[0];
-    verts[1].position = corners[1];
-    verts[2].position = corners[1];
-    verts[3].position = corners[2];
-    verts[4].position = corners[2];
-    verts[5].position = corners[3];
-    verts[6].position = corners[3];
-    verts[7].position = corners[0];
-
-    verts[8].position = corners[0];
-    verts[9].position = corners[4];
-    verts[10].position = corners[1];
-    verts[11].position = corners[5];
-    verts[12].position = corners[2];
-    verts[13].position = corners[6];
-    verts[14].position = corners[3];
-    verts[15].position = corners[7];
-
-    verts[16].position = corners[4];
-    verts[17].position = corners[5];
-    verts[18].position = corners[5];
-    verts[19].position = corners[6];
-    verts[20].position = corners[6];
-    verts[21].position = corners[7];
-    verts[22].position = corners[7];
-    verts[23].position = corners[4];
-
-    for (size_t j = 0; j < std::size(verts); ++j)
-    {
-        XMStoreFloat4(&verts[j].color, color);
-    }
-
-    batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINELIST, verts, static_cast<UINT>(std::size(verts)));
+    FrustumLines(batch, frustum, color);
 }
 
 void XM_CALLCONV DX::DrawGrid(PrimitiveBatch<VertexPositionColor>* batch,
@@ -150,32 +729,7 @@ void XM_CALLCONV DX::DrawGrid(PrimitiveBatch<VertexPositionColor>* batch,
     size_t ydivs,
     GXMVECTOR color)
 {
-    xdivs = std::max<size_t>(1, xdivs);
-    ydivs = std::max<size_t>(1, ydivs);
-
-    for (size_t i = 0; i <= xdivs; ++i)
-    {
-        float percent = float(i) / float(xdivs);
-        percent = (percent * 2.f) - 1.f;
-        XMVECTOR scale = XMVectorScale(xAxis, percent);
-        scale = XMVectorAdd(scale, origin);
-
-        const VertexPositionColor v1(XMVectorSubtract(scale, yAxis), color);
-        const VertexPositionColor v2(XMVectorAdd(scale, yAxis), color);
-        batch->DrawLine(v1, v2);
-    }
-
-    for (size_t i = 0; i <= ydivs; i++)
-    {
-        FLOAT percent = float(i) / float(ydivs);
-        percent = (percent * 2.f) - 1.f;
-        XMVECTOR scale = XMVectorScale(yAxis, percent);
-        scale = XMVectorAdd(scale, origin);
-
-        const VertexPositionColor v1(XMVectorSubtract(scale, xAxis), color);
-        const VertexPositionColor v2(XMVectorAdd(scale, xAxis), color);
-        batch->DrawLine(v1, v2);
-    }
+    GridLines(batch, xAxis, yAxis, origin, xdivs, ydivs, color);
 }
 
 void XM_CALLCONV DX::DrawRing(PrimitiveBatch<VertexPositionColor>* batch,
@@ -184,37 +738,7 @@ void XM_CALLCONV DX::DrawRing(PrimitiveBatch<VertexPositionColor>* batch,
     FXMVECTOR minorAxis,
     GXMVECTOR color)
 {
-    constexpr size_t c_ringSegments = 32;
-
-    VertexPositionColor verts[c_ringSegments + 1];
-
-    constexpr float fAngleDelta = XM_2PI / float(c_ringSegments);
-    // Instead of calling cos/sin for each segment we calculate
-    // the sign of the angle delta and then incrementally calculate sin
-    // and cosine from then on.
-    const XMVECTOR cosDelta = XMVectorReplicate(cosf(fAngleDelta));
-    const XMVECTOR sinDelta = XMVectorReplicate(sinf(fAngleDelta));
-    XMVECTOR incrementalSin = XMVectorZero();
-    static const XMVECTORF32 s_initialCos =
-    {
-        { { 1.f, 1.f, 1.f, 1.f } }
-    };
-    XMVECTOR incrementalCos = s_initialCos.v;
-    for (size_t i = 0; i < c_ringSegments; i++)
-    {
-        XMVECTOR pos = XMVectorMultiplyAdd(majorAxis, incrementalCos, origin);
-        pos = XMVectorMultiplyAdd(minorAxis, incrementalSin, pos);
-        XMStoreFloat3(&verts[i].position, pos);
-        XMStoreFloat4(&verts[i].color, color);
-        // Standard formula to rotate a vector.
-        const XMVECTOR newCos = XMVectorSubtract(XMVectorMultiply(incrementalCos, cosDelta), XMVectorMultiply(incrementalSin, sinDelta));
-        const XMVECTOR newSin = XMVectorAdd(XMVectorMultiply(incrementalCos, sinDelta), XMVectorMultiply(incrementalSin, cosDelta));
-        incrementalCos = newCos;
-        incrementalSin = newSin;
-    }
-    verts[c_ringSegments] = verts[0];
-
-    batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP, verts, c_ringSegments + 1);
+    RingLines(batch, origin, majorAxis, minorAxis, color);
 }
 
 void XM_CALLCONV DX::DrawRay(PrimitiveBatch<VertexPositionColor>* batch,
@@ -223,32 +747,7 @@ void XM_CALLCONV DX::DrawRay(PrimitiveBatch<VertexPositionColor>* batch,
     bool normalize,
     FXMVECTOR color)
 {
-    VertexPositionColor verts[3];
-    XMStoreFloat3(&verts[0].position, origin);
-
-    XMVECTOR normDirection = XMVector3Normalize(direction);
-    XMVECTOR rayDirection = (normalize) ? normDirection : direction;
-
-    XMVECTOR perpVector = XMVector3Cross(normDirection, g_XMIdentityR1);
-
-    if (XMVector3Equal(XMVector3LengthSq(perpVector), g_XMZero))
-    {
-        perpVector = XMVector3Cross(normDirection, g_XMIdentityR2);
-    }
-    perpVector = XMVector3Normalize(perpVector);
-
-    XMStoreFloat3(&verts[1].position, XMVectorAdd(rayDirection, origin));
-    perpVector = XMVectorScale(perpVector, 0.0625f);
-    normDirection = XMVectorScale(normDirection, -0.25f);
-    rayDirection = XMVectorAdd(perpVector, rayDirection);
-    rayDirection = XMVectorAdd(normDirection, rayDirection);
-    XMStoreFloat3(&verts[2].position, XMVectorAdd(rayDirection, origin));
-
-    XMStoreFloat4(&verts[0].color, color);
-    XMStoreFloat4(&verts[1].color, color);
-    XMStoreFloat4(&verts[2].color, color);
-
-    batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP, verts, 2);
+    RayLines(batch, origin, direction, normalize, color);
 }
 
 void XM_CALLCONV DX::DrawTriangle(PrimitiveBatch<VertexPositionColor>* batch,
@@ -257,18 +756,7 @@ void XM_CALLCONV DX::DrawTriangle(PrimitiveBatch<VertexPositionColor>* batch,
     FXMVECTOR pointC,
     GXMVECTOR color)
 {
-    VertexPositionColor verts[4];
-    XMStoreFloat3(&verts[0].position, pointA);
-    XMStoreFloat3(&verts[1].position, pointB);
-    XMStoreFloat3(&verts[2].position, pointC);
-    XMStoreFloat3(&verts[3].position, pointA);
-
-    XMStoreFloat4(&verts[0].color, color);
-    XMStoreFloat4(&verts[1].color, color);
-    XMStoreFloat4(&verts[2].color, color);
-    XMStoreFloat4(&verts[3].color, color);
-
-    batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP, verts, 4);
+    TriangleLines(batch, pointA, pointB, pointC, color);
 }
 
 void XM_CALLCONV DX::DrawQuad(PrimitiveBatch<VertexPositionColor>* batch,
@@ -278,18 +766,906 @@ void XM_CALLCONV DX::DrawQuad(PrimitiveBatch<VertexPositionColor>* batch,
     GXMVECTOR pointD,
     HXMVECTOR color)
 {
-    VertexPositionColor verts[5];
-    XMStoreFloat3(&verts[0].position, pointA);
-    XMStoreFloat3(&verts[1].position, pointB);
-    XMStoreFloat3(&verts[2].position, pointC);
-    XMStoreFloat3(&verts[3].position, pointD);
-    XMStoreFloat3(&verts[4].position, pointA);
+    QuadLines(batch, pointA, pointB, pointC, pointD, color);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
+    const BoundingSphere* spheres,
+    size_t count,
+    FXMVECTOR color,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    SphereLines(batch, spheres, count, ShapeColors(color), maxVertices, maxIndices);
+}
+
+void DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
+    const BoundingSphere* spheres,
+    size_t count,
+    const XMFLOAT4* colors,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    SphereLines(batch, spheres, count, ShapeColors(colors), maxVertices, maxIndices);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
+    const BoundingBox* boxes,
+    size_t count,
+    FXMVECTOR color,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    BoxLines(batch, boxes, count, ShapeColors(color), maxVertices, maxIndices);
+}
+
+void DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
+    const BoundingBox* boxes,
+    size_t count,
+    const XMFLOAT4* colors,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    BoxLines(batch, boxes, count, ShapeColors(colors), maxVertices, maxIndices);
+}
 
-    XMStoreFloat4(&verts[0].color, color);
-    XMStoreFloat4(&verts[1].color, color);
-    XMStoreFloat4(&verts[2].color, color);
-    XMStoreFloat4(&verts[3].color, color);
-    XMStoreFloat4(&verts[4].color, color);
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
+    const BoundingOrientedBox* boxes,
+    size_t count,
+    FXMVECTOR color,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    BoxLines(batch, boxes, count, ShapeColors(color), maxVertices, maxIndices);
+}
 
-    batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP, verts, 5);
+void DX::Draw(PrimitiveBatch<VertexPositionColor>* batch,
+    const BoundingOrientedBox* boxes,
+    size_t count,
+    const XMFLOAT4* colors,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    BoxLines(batch, boxes, count, ShapeColors(colors), maxVertices, maxIndices);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Drawing to a PrimitiveBatch with packed colors
+//--------------------------------------------------------------------------------------
+
+const D3D11_INPUT_ELEMENT_DESC DX::VertexPositionPackedColor::InputElements[] =
+{
+    { "SV_Position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "COLOR",       0, DXGI_FORMAT_R8G8B8A8_UNORM,  0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+};
+
+static_assert(sizeof(DX::VertexPositionPackedColor) == 16, "Vertex struct/layout mismatch");
+
+DX::VertexPositionPackedColor::VertexPositionPackedColor(FXMVECTOR iposition, FXMVECTOR icolor) noexcept
+{
+    XMStoreFloat3(&position, iposition);
+    StoreColor(color, icolor);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingSphere& sphere,
+    FXMVECTOR color)
+{
+    SphereLines(batch, sphere, color);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingBox& box,
+    FXMVECTOR color)
+{
+    BoxLines(batch, box, color);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingOrientedBox& obb,
+    FXMVECTOR color)
+{
+    BoxLines(batch, obb, color);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingFrustum& frustum,
+    FXMVECTOR color)
+{
+    FrustumLines(batch, frustum, color);
+}
+
+void XM_CALLCONV DX::DrawGrid(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    FXMVECTOR xAxis,
+    FXMVECTOR yAxis,
+    FXMVECTOR origin,
+    size_t xdivs,
+    size_t ydivs,
+    GXMVECTOR color)
+{
+    GridLines(batch, xAxis, yAxis, origin, xdivs, ydivs, color);
+}
+
+void XM_CALLCONV DX::DrawRing(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    FXMVECTOR origin,
+    FXMVECTOR majorAxis,
+    FXMVECTOR minorAxis,
+    GXMVECTOR color)
+{
+    RingLines(batch, origin, majorAxis, minorAxis, color);
+}
+
+void XM_CALLCONV DX::DrawRay(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    FXMVECTOR origin,
+    FXMVECTOR direction,
+    bool normalize,
+    FXMVECTOR color)
+{
+    RayLines(batch, origin, direction, normalize, color);
+}
+
+void XM_CALLCONV DX::DrawTriangle(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    FXMVECTOR pointA,
+    FXMVECTOR pointB,
+    FXMVECTOR pointC,
+    GXMVECTOR color)
+{
+    TriangleLines(batch, pointA, pointB, pointC, color);
+}
+
+void XM_CALLCONV DX::DrawQuad(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    FXMVECTOR pointA,
+    FXMVECTOR pointB,
+    FXMVECTOR pointC,
+    GXMVECTOR pointD,
+    HXMVECTOR color)
+{
+    QuadLines(batch, pointA, pointB, pointC, pointD, color);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingSphere* spheres,
+    size_t count,
+    FXMVECTOR color,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    SphereLines(batch, spheres, count, ShapeColors(color), maxVertices, maxIndices);
+}
+
+void DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingSphere* spheres,
+    size_t count,
+    const XMFLOAT4* colors,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    SphereLines(batch, spheres, count, ShapeColors(colors), maxVertices, maxIndices);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingBox* boxes,
+    size_t count,
+    FXMVECTOR color,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    BoxLines(batch, boxes, count, ShapeColors(color), maxVertices, maxIndices);
+}
+
+void DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingBox* boxes,
+    size_t count,
+    const XMFLOAT4* colors,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    BoxLines(batch, boxes, count, ShapeColors(colors), maxVertices, maxIndices);
+}
+
+void XM_CALLCONV DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingOrientedBox* boxes,
+    size_t count,
+    FXMVECTOR color,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    BoxLines(batch, boxes, count, ShapeColors(color), maxVertices, maxIndices);
+}
+
+void DX::Draw(PrimitiveBatch<VertexPositionPackedColor>* batch,
+    const BoundingOrientedBox* boxes,
+    size_t count,
+    const XMFLOAT4* colors,
+    size_t maxVertices,
+    size_t maxIndices)
+{
+    BoxLines(batch, boxes, count, ShapeColors(colors), maxVertices, maxIndices);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Recording from any thread
+//--------------------------------------------------------------------------------------
+
+void XM_CALLCONV DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingSphere& sphere,
+    FXMVECTOR color)
+{
+    if (recorder->IsCulled(sphere))
+        return;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    SphereLines(&writer, sphere, color, recorder->GetView());
+}
+
+void XM_CALLCONV DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingBox& box,
+    FXMVECTOR color)
+{
+    if (recorder->IsCulled(box))
+        return;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    BoxLines(&writer, box, color);
+}
+
+void XM_CALLCONV DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingOrientedBox& obb,
+    FXMVECTOR color)
+{
+    if (recorder->IsCulled(obb))
+        return;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    BoxLines(&writer, obb, color);
+}
+
+void XM_CALLCONV DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingFrustum& frustum,
+    FXMVECTOR color)
+{
+    if (recorder->IsCulled(frustum))
+        return;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    FrustumLines(&writer, frustum, color);
+}
+
+void XM_CALLCONV DX::DrawGrid(DebugDrawRecorder* recorder,
+    FXMVECTOR xAxis,
+    FXMVECTOR yAxis,
+    FXMVECTOR origin,
+    size_t xdivs,
+    size_t ydivs,
+    GXMVECTOR color)
+{
+    BoundingSphere bounds;
+    XMStoreFloat3(&bounds.Center, origin);
+    bounds.Radius = XMVectorGetX(XMVectorAdd(XMVector3Length(xAxis), XMVector3Length(yAxis)));
+
+    if (recorder->IsCulled(bounds))
+        return;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    GridLines(&writer, xAxis, yAxis, origin, xdivs, ydivs, color);
+}
+
+void XM_CALLCONV DX::DrawRing(DebugDrawRecorder* recorder,
+    FXMVECTOR origin,
+    FXMVECTOR majorAxis,
+    FXMVECTOR minorAxis,
+    GXMVECTOR color)
+{
+    BoundingSphere bounds;
+    XMStoreFloat3(&bounds.Center, origin);
+    bounds.Radius = XMVectorGetX(XMVectorMax(XMVector3Length(majorAxis), XMVector3Length(minorAxis)));
+
+    if (recorder->IsCulled(bounds))
+        return;
+
+    const DebugDrawView* view = recorder->GetView();
+    const size_t segments = view ? view->GetRingSegments(origin, bounds.Radius) : c_ringSegments;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    RingLines(&writer, origin, majorAxis, minorAxis, color, segments);
+}
+
+void XM_CALLCONV DX::DrawRay(DebugDrawRecorder* recorder,
+    FXMVECTOR origin,
+    FXMVECTOR direction,
+    bool normalize,
+    FXMVECTOR color)
+{
+    const XMVECTOR end = XMVectorAdd(origin, normalize ? XMVector3Normalize(direction) : direction);
+
+    BoundingBox bounds;
+    BoundingBox::CreateFromPoints(bounds, XMVectorMin(origin, end), XMVectorMax(origin, end));
+
+    if (recorder->IsCulled(bounds))
+        return;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    RayLines(&writer, origin, direction, normalize, color);
+}
+
+void XM_CALLCONV DX::DrawTriangle(DebugDrawRecorder* recorder,
+    FXMVECTOR pointA,
+    FXMVECTOR pointB,
+    FXMVECTOR pointC,
+    GXMVECTOR color)
+{
+    BoundingBox bounds;
+    BoundingBox::CreateFromPoints(bounds,
+        XMVectorMin(XMVectorMin(pointA, pointB), pointC),
+        XMVectorMax(XMVectorMax(pointA, pointB), pointC));
+
+    if (recorder->IsCulled(bounds))
+        return;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    TriangleLines(&writer, pointA, pointB, pointC, color);
+}
+
+void XM_CALLCONV DX::DrawQuad(DebugDrawRecorder* recorder,
+    FXMVECTOR pointA,
+    FXMVECTOR pointB,
+    FXMVECTOR pointC,
+    GXMVECTOR pointD,
+    HXMVECTOR color)
+{
+    BoundingBox bounds;
+    BoundingBox::CreateFromPoints(bounds,
+        XMVectorMin(XMVectorMin(pointA, pointB), XMVectorMin(pointC, pointD)),
+        XMVectorMax(XMVectorMax(pointA, pointB), XMVectorMax(pointC, pointD)));
+
+    if (recorder->IsCulled(bounds))
+        return;
+
+    LineListWriter writer(recorder->GetThreadLines());
+    QuadLines(&writer, pointA, pointB, pointC, pointD, color);
+}
+
+void XM_CALLCONV DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingSphere* spheres,
+    size_t count,
+    FXMVECTOR color)
+{
+    if (recorder->GetView())
+    {
+        for (size_t j = 0; j < count; ++j)
+        {
+            Draw(recorder, spheres[j], color);
+        }
+        return;
+    }
+
+    LineListWriter writer(recorder->GetThreadLines());
+    SphereLines(&writer, spheres, count, ShapeColors(color));
+}
+
+void DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingSphere* spheres,
+    size_t count,
+    const XMFLOAT4* colors)
+{
+    if (recorder->GetView() && colors)
+    {
+        for (size_t j = 0; j < count; ++j)
+        {
+            Draw(recorder, spheres[j], XMLoadFloat4(&colors[j]));
+        }
+        return;
+    }
+
+    LineListWriter writer(recorder->GetThreadLines());
+    SphereLines(&writer, spheres, count, ShapeColors(colors));
+}
+
+void XM_CALLCONV DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingBox* boxes,
+    size_t count,
+    FXMVECTOR color)
+{
+    if (recorder->GetView())
+    {
+        for (size_t j = 0; j < count; ++j)
+        {
+            Draw(recorder, boxes[j], color);
+        }
+        return;
+    }
+
+    LineListWriter writer(recorder->GetThreadLines());
+    BoxLines(&writer, boxes, count, ShapeColors(color));
+}
+
+void DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingBox* boxes,
+    size_t count,
+    const XMFLOAT4* colors)
+{
+    if (recorder->GetView() && colors)
+    {
+        for (size_t j = 0; j < count; ++j)
+        {
+            Draw(recorder, boxes[j], XMLoadFloat4(&colors[j]));
+        }
+        return;
+    }
+
+    LineListWriter writer(recorder->GetThreadLines());
+    BoxLines(&writer, boxes, count, ShapeColors(colors));
+}
+
+void XM_CALLCONV DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingOrientedBox* boxes,
+    size_t count,
+    FXMVECTOR color)
+{
+    if (recorder->GetView())
+    {
+        for (size_t j = 0; j < count; ++j)
+        {
+            Draw(recorder, boxes[j], color);
+        }
+        return;
+    }
+
+    LineListWriter writer(recorder->GetThreadLines());
+    BoxLines(&writer, boxes, count, ShapeColors(color));
+}
+
+void DX::Draw(DebugDrawRecorder* recorder,
+    const BoundingOrientedBox* boxes,
+    size_t count,
+    const XMFLOAT4* colors)
+{
+    if (recorder->GetView() && colors)
+    {
+        for (size_t j = 0; j < count; ++j)
+        {
+            Draw(recorder, boxes[j], XMLoadFloat4(&colors[j]));
+        }
+        return;
+    }
+
+    LineListWriter writer(recorder->GetThreadLines());
+    BoxLines(&writer, boxes, count, ShapeColors(colors));
+}
+
+DX::DebugDrawView::DebugDrawView(
+    CXMMATRIX view,
+    CXMMATRIX projection,
+    float viewportHeight,
+    float pixelsPerSegment,
+    bool rhcoords) :
+    m_frustum{},
+    m_box{},
+    m_eye{},
+    m_pixelScale(0.5f * viewportHeight * XMVectorGetY(projection.r[1])),
+    m_pixelsPerSegment(pixelsPerSegment),
+    m_perspective(XMVectorGetW(projection.r[2]) != 0.f)
+{
+    if (!(viewportHeight > 0.f) || !(pixelsPerSegment > 0.f))
+    {
+        throw std::invalid_argument("Viewport height and segment length must be positive");
+    }
+
+    const XMMATRIX invView = XMMatrixInverse(nullptr, view);
+    if (m_perspective)
+    {
+        BoundingFrustum::CreateFromMatrix(m_frustum, projection, rhcoords);
+        m_frustum.Transform(m_frustum, invView);
+    }
+    else
+    {
+        // BoundingFrustum assumes a perspective divide, so an orthographic view volume is built as a box
+        // from the corners of clip space
+        const XMMATRIX invProjection = XMMatrixInverse(nullptr, projection);
+        const XMVECTOR corners[2] =
+        {
+            XMVector3TransformCoord(XMVectorSet(-1.f, -1.f, 0.f, 0.f), invProjection),
+            XMVector3TransformCoord(XMVectorSet(1.f, 1.f, 1.f, 0.f), invProjection),
+        };
+
+        BoundingBox box;
+        BoundingBox::CreateFromPoints(box, corners[0], corners[1]);
+        BoundingOrientedBox::CreateFromBoundingBox(m_box, box);
+        m_box.Transform(m_box, invView);
+    }
+    XMStoreFloat3(&m_eye, invView.r[3]);
+}
+
+float XM_CALLCONV DX::DebugDrawView::GetProjectedRadius(FXMVECTOR center, float radius) const noexcept
+{
+    if (!m_perspective)
+        return radius * m_pixelScale;
+
+    const float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(center, XMLoadFloat3(&m_eye))));
+    if (distance <= radius)
+        return FLT_MAX;
+
+    return radius * m_pixelScale / distance;
+}
+
+size_t XM_CALLCONV DX::DebugDrawView::GetRingSegments(FXMVECTOR center, float radius) const noexcept
+{
+    const float pixels = GetProjectedRadius(center, radius) * XM_2PI;
+    if (pixels >= float(c_maxRingSegments) * m_pixelsPerSegment)
+        return c_maxRingSegments;
+
+    const auto segments = static_cast<size_t>(std::ceil(pixels / m_pixelsPerSegment));
+    return std::max(segments, c_minRingSegments);
+}
+
+DX::DebugDrawRecorder::DebugDrawRecorder() :
+    m_id(++s_recorderId),
+    m_buffers(nullptr)
+{
+    // Ids only increase, so the list stays sorted
+    std::lock_guard<std::mutex> lock(s_recorderLock);
+    s_liveRecorders.push_back(m_id);
+}
+
+DX::DebugDrawRecorder::~DebugDrawRecorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_recorderLock);
+        auto it = std::lower_bound(s_liveRecorders.begin(), s_liveRecorders.end(), m_id);
+        if (it != s_liveRecorders.end() && *it == m_id)
+        {
+            s_liveRecorders.erase(it);
+        }
+        ++s_recorderGeneration;
+    }
+
+    ThreadBuffer* buffer = m_buffers.load();
+    while (buffer)
+    {
+        ThreadBuffer* next = buffer->next;
+        delete buffer;
+        buffer = next;
+    }
+}
+
+std::vector<VertexPositionColor>& DX::DebugDrawRecorder::GetThreadLines()
+{
+    return GetThreadBuffer().lines;
+}
+
+void DX::DebugDrawRecorder::SetView(const DebugDrawView& view)
+{
+    m_view = std::make_unique<DebugDrawView>(view);
+}
+
+void DX::DebugDrawRecorder::ClearView() noexcept
+{
+    m_view.reset();
+}
+
+DX::DebugDrawRecorder::ThreadBuffer& DX::DebugDrawRecorder::GetThreadBuffer()
+{
+    // Each thread remembers its buffer for every recorder it has used. Ids are never reused, so entries
+    // for destroyed recorders are never matched, and they are dropped the next time this thread starts
+    // using a recorder.
+    thread_local std::vector<std::pair<uint64_t, ThreadBuffer*>> t_buffers;
+    thread_local size_t t_last = 0;
+    thread_local uint64_t t_generation = 0;
+
+    if (t_last < t_buffers.size() && t_buffers[t_last].first == m_id)
+        return *t_buffers[t_last].second;
+
+    for (size_t j = 0; j < t_buffers.size(); ++j)
+    {
+        if (t_buffers[j].first == m_id)
+        {
+            t_last = j;
+            return *t_buffers[j].second;
+        }
+    }
+
+    const uint64_t generation = s_recorderGeneration.load();
+    if (generation != t_generation)
+    {
+        std::lock_guard<std::mutex> lock(s_recorderLock);
+        t_buffers.erase(std::remove_if(t_buffers.begin(), t_buffers.end(),
+            [](const std::pair<uint64_t, ThreadBuffer*>& entry)
+            {
+                return !std::binary_search(s_liveRecorders.begin(), s_liveRecorders.end(), entry.first);
+            }), t_buffers.end());
+        t_generation = generation;
+    }
+
+    // First use on this thread, so add a buffer to the list without locking
+    auto buffer = new ThreadBuffer;
+    buffer->culled = 0;
+    buffer->next = m_buffers.load(std::memory_order_relaxed);
+    while (!m_buffers.compare_exchange_weak(buffer->next, buffer,
+        std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+
+    t_last = t_buffers.size();
+    t_buffers.emplace_back(m_id, buffer);
+
+    return *buffer;
+}
+
+size_t DX::DebugDrawRecorder::Flush(PrimitiveBatch<VertexPositionColor>* batch, size_t maxVertices)
+{
+    // PrimitiveBatch rejects draws of exactly its limit, and each draw has to be whole lines
+    maxVertices = (maxVertices > 0) ? ((maxVertices - 1) & ~size_t(1)) : 0;
+    if (!batch || !maxVertices)
+    {
+        throw std::invalid_argument("Batch and a vertex limit are required");
+    }
+
+    size_t total = 0;
+    for (ThreadBuffer* buffer = m_buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    {
+        const size_t count = buffer->lines.size();
+        for (size_t j = 0; j < count; j += maxVertices)
+        {
+            batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINELIST, buffer->lines.data() + j, std::min(maxVertices, count - j));
+        }
+        total += count;
+
+        // Keep the capacity for the next frame
+        buffer->lines.clear();
+        buffer->culled = 0;
+    }
+
+    return total;
+}
+
+size_t DX::DebugDrawRecorder::Flush(std::vector<VertexPositionColor>& lines)
+{
+    size_t total = 0;
+    for (ThreadBuffer* buffer = m_buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    {
+        lines.insert(lines.end(), buffer->lines.cbegin(), buffer->lines.cend());
+        total += buffer->lines.size();
+
+        buffer->lines.clear();
+        buffer->culled = 0;
+    }
+
+    return total;
+}
+
+void DX::DebugDrawRecorder::Clear() noexcept
+{
+    for (ThreadBuffer* buffer = m_buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    {
+        buffer->lines.clear();
+        buffer->culled = 0;
+    }
+}
+
+size_t DX::DebugDrawRecorder::GetVertexCount() const noexcept
+{
+    size_t count = 0;
+    for (const ThreadBuffer* buffer = m_buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    {
+        count += buffer->lines.size();
+    }
+    return count;
+}
+
+size_t DX::DebugDrawRecorder::GetCulledCount() const noexcept
+{
+    size_t count = 0;
+    for (const ThreadBuffer* buffer = m_buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    {
+        count += buffer->culled;
+    }
+    return count;
+}
+
+size_t DX::DebugDrawRecorder::GetThreadCount() const noexcept
+{
+    size_t count = 0;
+    for (const ThreadBuffer* buffer = m_buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    {
+        ++count;
+    }
+    return count;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Retained geometry
+//--------------------------------------------------------------------------------------
+
+DX::DebugDrawRetained::DebugDrawRetained() noexcept :
+    m_nextHandle(c_InvalidHandle),
+    m_cachedVertices(0),
+    m_cacheDirty(false),
+    m_stats{}
+{
+}
+
+void DX::DebugDrawRetained::SetDevice(ID3D11Device* device)
+{
+    if (device == m_device.Get())
+        return;
+
+    if (m_device)
+    {
+        ReleaseDevice();
+    }
+
+    m_device = device;
+    m_cacheDirty = true;
+}
+
+void DX::DebugDrawRetained::ReleaseDevice() noexcept
+{
+    m_vertexBuffer.Reset();
+    m_device.Reset();
+    m_cachedVertices = 0;
+}
+
+DX::DebugDrawRetained::Handle DX::DebugDrawRetained::Add(
+    const VertexPositionColor* lines,
+    size_t count,
+    float duration)
+{
+    if (count > 0 && !lines)
+    {
+        throw std::invalid_argument("Lines required");
+    }
+
+    if (count & 1)
+    {
+        throw std::invalid_argument("Line lists need an even number of vertices");
+    }
+
+    Entry entry;
+    entry.handle = ++m_nextHandle;
+    entry.remaining = duration;
+    entry.lines.assign(lines, lines + count);
+
+    return Insert(std::move(entry));
+}
+
+DX::DebugDrawRetained::Handle DX::DebugDrawRetained::Add(DebugDrawRecorder& recorder, float duration)
+{
+    Entry entry;
+    entry.handle = ++m_nextHandle;
+    entry.remaining = duration;
+    recorder.Flush(entry.lines);
+
+    return Insert(std::move(entry));
+}
+
+DX::DebugDrawRetained::Handle DX::DebugDrawRetained::Insert(Entry&& entry)
+{
+    if (entry.remaining == c_UntilRemoved)
+    {
+        m_cacheDirty = true;
+    }
+
+    const Handle handle = entry.handle;
+    m_entries.emplace_back(std::move(entry));
+    return handle;
+}
+
+bool DX::DebugDrawRetained::Remove(Handle handle) noexcept
+{
+    auto it = std::find_if(m_entries.begin(), m_entries.end(),
+        [handle](const Entry& entry) { return entry.handle == handle; });
+    if (it == m_entries.end())
+        return false;
+
+    if (it->remaining == c_UntilRemoved)
+    {
+        m_cacheDirty = true;
+    }
+
+    m_entries.erase(it);
+    return true;
+}
+
+void DX::DebugDrawRetained::Clear() noexcept
+{
+    m_entries.clear();
+    m_cacheDirty = true;
+}
+
+void DX::DebugDrawRetained::Update(float elapsedSeconds)
+{
+    m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+        [elapsedSeconds](Entry& entry)
+        {
+            if (entry.remaining == c_UntilRemoved)
+                return false;
+
+            entry.remaining -= elapsedSeconds;
+            return entry.remaining <= 0.f;
+        }), m_entries.end());
+}
+
+void DX::DebugDrawRetained::Draw(ID3D11DeviceContext* context)
+{
+    if (!m_device)
+    {
+        throw std::logic_error("SetDevice must be called first");
+    }
+
+    if (m_cacheDirty)
+    {
+        // Only rebuilt when geometry without a lifetime is added or removed
+        std::vector<VertexPositionColor> lines;
+        for (const auto& entry : m_entries)
+        {
+            if (entry.remaining == c_UntilRemoved)
+            {
+                lines.insert(lines.end(), entry.lines.cbegin(), entry.lines.cend());
+            }
+        }
+
+        if (lines.size() > UINT32_MAX)
+        {
+            throw std::out_of_range("Too many retained lines");
+        }
+
+        m_vertexBuffer.Reset();
+        if (!lines.empty())
+        {
+            ThrowIfFailed(CreateStaticBuffer(m_device.Get(), lines, D3D11_BIND_VERTEX_BUFFER,
+                m_vertexBuffer.ReleaseAndGetAddressOf()));
+        }
+
+        m_cachedVertices = lines.size();
+        m_cacheDirty = false;
+    }
+
+    m_stats.cachedVertices = m_cachedVertices;
+
+    if (!m_cachedVertices)
+        return;
+
+    constexpr UINT stride = sizeof(VertexPositionColor);
+    constexpr UINT offset = 0;
+    context->IASetVertexBuffers(0, 1, m_vertexBuffer.GetAddressOf(), &stride, &offset);
+    context->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_LINELIST);
+    context->Draw(static_cast<UINT>(m_cachedVertices), 0);
+}
+
+size_t DX::DebugDrawRetained::Draw(PrimitiveBatch<VertexPositionColor>* batch, size_t maxVertices)
+{
+    // Same limit as DebugDrawRecorder::Flush
+    maxVertices = (maxVertices > 0) ? ((maxVertices - 1) & ~size_t(1)) : 0;
+    if (!batch || !maxVertices)
+    {
+        throw std::invalid_argument("Batch and a vertex limit are required");
+    }
+
+    size_t total = 0;
+    for (const auto& entry : m_entries)
+    {
+        // Lines without a lifetime are in the vertex buffer when there is a device
+        if (m_device && entry.remaining == c_UntilRemoved)
+            continue;
+
+        const size_t count = entry.lines.size();
+        for (size_t j = 0; j < count; j += maxVertices)
+        {
+            batch->Draw(D3D_PRIMITIVE_TOPOLOGY_LINELIST, entry.lines.data() + j, std::min(maxVertices, count - j));
+        }
+        total += count;
+    }
+
+    m_stats.batchedVertices = total;
+    return total;
+}
+
+DX::DebugDrawRetained::Stats DX::DebugDrawRetained::GetStats() const noexcept
+{
+    Stats stats = m_stats;
+    stats.entries = m_entries.size();
+    return stats;
 }
@@ -15,6 +15,15 @@
 #include "PrimitiveBatch.h"
 #include "VertexTypes.h"
 
+#include <wrl/client.h>
+
+#include <atomic>
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 
 namespace DX
 {
@@ -54,4 +63,376 @@ namespace DX
     void XM_CALLCONV DrawQuad(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch,
         DirectX::FXMVECTOR pointA, DirectX::FXMVECTOR pointB, DirectX::FXMVECTOR pointC, DirectX::GXMVECTOR pointD,
         DirectX::HXMVECTOR color = DirectX::Colors::White);
+
+    // Draws many shapes in as few indexed line list draws as fit in a batch created with the default
+    // limits, either in one color or with a color per shape
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch,
+        _In_reads_(count) const DirectX::BoundingSphere* spheres, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch,
+        _In_reads_(count) const DirectX::BoundingSphere* spheres, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch,
+        _In_reads_(count) const DirectX::BoundingBox* boxes, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch,
+        _In_reads_(count) const DirectX::BoundingBox* boxes, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch,
+        _In_reads_(count) const DirectX::BoundingOrientedBox* boxes, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch,
+        _In_reads_(count) const DirectX::BoundingOrientedBox* boxes, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    // Position with an RGBA8 color, 16 bytes per vertex rather than the 28 of VertexPositionColor. Works with
+    // BasicEffect's vertex color, which reads the color as a normalized float4.
+    struct VertexPositionPackedColor
+    {
+        VertexPositionPackedColor() = default;
+
+        VertexPositionPackedColor(const VertexPositionPackedColor&) = default;
+        VertexPositionPackedColor& operator=(const VertexPositionPackedColor&) = default;
+
+        VertexPositionPackedColor(VertexPositionPackedColor&&) = default;
+        VertexPositionPackedColor& operator=(VertexPositionPackedColor&&) = default;
+
+        VertexPositionPackedColor(const DirectX::XMFLOAT3& iposition, uint32_t icolor) noexcept :
+            position(iposition),
+            color(icolor)
+        {
+        }
+
+        VertexPositionPackedColor(DirectX::FXMVECTOR iposition, DirectX::FXMVECTOR icolor) noexcept;
+
+        DirectX::XMFLOAT3   position;
+        uint32_t            color;      // DXGI_FORMAT_R8G8B8A8_UNORM
+
+        static constexpr unsigned int InputElementCount = 2;
+        static const D3D11_INPUT_ELEMENT_DESC InputElements[InputElementCount];
+    };
+
+    // The same shapes for a batch of packed color vertices, converting each color once per shape
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        const DirectX::BoundingSphere& sphere,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        const DirectX::BoundingBox& box,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        const DirectX::BoundingOrientedBox& obb,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        const DirectX::BoundingFrustum& frustum,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawGrid(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        DirectX::FXMVECTOR xAxis, DirectX::FXMVECTOR yAxis,
+        DirectX::FXMVECTOR origin, size_t xdivs, size_t ydivs,
+        DirectX::GXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawRing(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        DirectX::FXMVECTOR origin, DirectX::FXMVECTOR majorAxis, DirectX::FXMVECTOR minorAxis,
+        DirectX::GXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawRay(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, bool normalize = true,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawTriangle(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        DirectX::FXMVECTOR pointA, DirectX::FXMVECTOR pointB, DirectX::FXMVECTOR pointC,
+        DirectX::GXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawQuad(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        DirectX::FXMVECTOR pointA, DirectX::FXMVECTOR pointB, DirectX::FXMVECTOR pointC, DirectX::GXMVECTOR pointD,
+        DirectX::HXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        _In_reads_(count) const DirectX::BoundingSphere* spheres, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        _In_reads_(count) const DirectX::BoundingSphere* spheres, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        _In_reads_(count) const DirectX::BoundingBox* boxes, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        _In_reads_(count) const DirectX::BoundingBox* boxes, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void XM_CALLCONV Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        _In_reads_(count) const DirectX::BoundingOrientedBox* boxes, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    void Draw(DirectX::PrimitiveBatch<VertexPositionPackedColor>* batch,
+        _In_reads_(count) const DirectX::BoundingOrientedBox* boxes, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors,
+        size_t maxVertices = 4096, size_t maxIndices = 4096 * 3);
+
+    // Camera used to cull recorded shapes against the view frustum, and to pick the number of ring segments
+    // from a shape's size on screen. Orthographic projections cull against the view box instead.
+    class DebugDrawView
+    {
+    public:
+        static constexpr size_t c_minRingSegments = 4;
+        static constexpr size_t c_maxRingSegments = 32;
+
+        // pixelsPerSegment is the on-screen length to aim for along each ring segment
+        DebugDrawView(
+            DirectX::CXMMATRIX view,
+            DirectX::CXMMATRIX projection,
+            float viewportHeight,
+            float pixelsPerSegment = 8.f,
+            bool rhcoords = true);
+
+        bool IsVisible(const DirectX::BoundingSphere& sphere) const noexcept { return m_perspective ? m_frustum.Intersects(sphere) : m_box.Intersects(sphere); }
+        bool IsVisible(const DirectX::BoundingBox& box) const noexcept { return m_perspective ? m_frustum.Intersects(box) : m_box.Intersects(box); }
+        bool IsVisible(const DirectX::BoundingOrientedBox& box) const noexcept { return m_perspective ? m_frustum.Intersects(box) : m_box.Intersects(box); }
+        bool IsVisible(const DirectX::BoundingFrustum& frustum) const noexcept { return m_perspective ? m_frustum.Intersects(frustum) : m_box.Intersects(frustum); }
+
+        // Radius in pixels, or FLT_MAX if the camera is inside the sphere
+        float XM_CALLCONV GetProjectedRadius(DirectX::FXMVECTOR center, float radius) const noexcept;
+
+        size_t XM_CALLCONV GetRingSegments(DirectX::FXMVECTOR center, float radius) const noexcept;
+
+        // The frustum is only set for perspective projections, and the box only for orthographic ones
+        const DirectX::BoundingFrustum& GetFrustum() const noexcept { return m_frustum; }
+        const DirectX::BoundingOrientedBox& GetBox() const noexcept { return m_box; }
+        bool IsPerspective() const noexcept { return m_perspective; }
+        DirectX::XMVECTOR GetEyePosition() const noexcept { return DirectX::XMLoadFloat3(&m_eye); }
+
+    private:
+        DirectX::BoundingFrustum    m_frustum;
+        DirectX::BoundingOrientedBox m_box;
+        DirectX::XMFLOAT3           m_eye;
+        float                       m_pixelScale;
+        float                       m_pixelsPerSegment;
+        bool                        m_perspective;
+    };
+
+    // Records debug shapes from any number of threads, such as physics or AI jobs, for drawing on the
+    // render thread. Each thread appends to its own line list, so after a thread's first use no locks
+    // are taken.
+    class DebugDrawRecorder
+    {
+    public:
+        DebugDrawRecorder();
+        ~DebugDrawRecorder();
+
+        DebugDrawRecorder(DebugDrawRecorder&&) = delete;
+        DebugDrawRecorder& operator= (DebugDrawRecorder&&) = delete;
+
+        DebugDrawRecorder(DebugDrawRecorder const&) = delete;
+        DebugDrawRecorder& operator= (DebugDrawRecorder const&) = delete;
+
+        // Line list for the calling thread, created on first use. Only the calling thread may append to it.
+        std::vector<DirectX::VertexPositionColor>& GetThreadLines();
+
+        // Draws the lines recorded by every thread as line lists, and clears them. Must not be called while
+        // other threads are recording. maxVertices is the vertex limit the batch was created with, and each
+        // draw uses at most maxVertices - 1 rounded down to whole lines. Returns the number of vertices drawn.
+        size_t Flush(_In_ DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch, size_t maxVertices = 4096);
+
+        // Appends the recorded lines to a line list instead of drawing them
+        size_t Flush(std::vector<DirectX::VertexPositionColor>& lines);
+
+        void Clear() noexcept;
+
+        // With a view, recorded shapes outside the frustum are skipped and rings are sized by their size on
+        // screen. Set once per frame before any thread starts recording.
+        void SetView(const DebugDrawView& view);
+        void ClearView() noexcept;
+
+        const DebugDrawView* GetView() const noexcept { return m_view.get(); }
+
+        // True if there is a view and the bounds are outside it, which is counted by GetCulledCount
+        template<typename TBounds>
+        bool IsCulled(const TBounds& bounds)
+        {
+            if (!m_view || m_view->IsVisible(bounds))
+                return false;
+
+            ++GetThreadBuffer().culled;
+            return true;
+        }
+
+        size_t GetVertexCount() const noexcept;
+        size_t GetCulledCount() const noexcept;
+        size_t GetThreadCount() const noexcept;
+
+    private:
+        struct ThreadBuffer
+        {
+            std::vector<DirectX::VertexPositionColor>   lines;
+            size_t                                      culled;
+            ThreadBuffer*                               next;
+        };
+
+        ThreadBuffer& GetThreadBuffer();
+
+        uint64_t                        m_id;
+        std::atomic<ThreadBuffer*>      m_buffers;
+        std::unique_ptr<DebugDrawView>  m_view;
+    };
+
+    // Each shape can be recorded from any thread, and is drawn by DebugDrawRecorder::Flush. Shapes outside
+    // the recorder's view are skipped.
+    void XM_CALLCONV Draw(_In_ DebugDrawRecorder* recorder,
+        const DirectX::BoundingSphere& sphere,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV Draw(_In_ DebugDrawRecorder* recorder,
+        const DirectX::BoundingBox& box,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV Draw(_In_ DebugDrawRecorder* recorder,
+        const DirectX::BoundingOrientedBox& obb,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV Draw(_In_ DebugDrawRecorder* recorder,
+        const DirectX::BoundingFrustum& frustum,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawGrid(_In_ DebugDrawRecorder* recorder,
+        DirectX::FXMVECTOR xAxis, DirectX::FXMVECTOR yAxis,
+        DirectX::FXMVECTOR origin, size_t xdivs, size_t ydivs,
+        DirectX::GXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawRing(_In_ DebugDrawRecorder* recorder,
+        DirectX::FXMVECTOR origin, DirectX::FXMVECTOR majorAxis, DirectX::FXMVECTOR minorAxis,
+        DirectX::GXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawRay(_In_ DebugDrawRecorder* recorder,
+        DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, bool normalize = true,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawTriangle(_In_ DebugDrawRecorder* recorder,
+        DirectX::FXMVECTOR pointA, DirectX::FXMVECTOR pointB, DirectX::FXMVECTOR pointC,
+        DirectX::GXMVECTOR color = DirectX::Colors::White);
+
+    void XM_CALLCONV DrawQuad(_In_ DebugDrawRecorder* recorder,
+        DirectX::FXMVECTOR pointA, DirectX::FXMVECTOR pointB, DirectX::FXMVECTOR pointC, DirectX::GXMVECTOR pointD,
+        DirectX::HXMVECTOR color = DirectX::Colors::White);
+
+    // Bulk versions, recorded as line lists
+    void XM_CALLCONV Draw(_In_ DebugDrawRecorder* recorder,
+        _In_reads_(count) const DirectX::BoundingSphere* spheres, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void Draw(_In_ DebugDrawRecorder* recorder,
+        _In_reads_(count) const DirectX::BoundingSphere* spheres, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors);
+
+    void XM_CALLCONV Draw(_In_ DebugDrawRecorder* recorder,
+        _In_reads_(count) const DirectX::BoundingBox* boxes, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void Draw(_In_ DebugDrawRecorder* recorder,
+        _In_reads_(count) const DirectX::BoundingBox* boxes, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors);
+
+    void XM_CALLCONV Draw(_In_ DebugDrawRecorder* recorder,
+        _In_reads_(count) const DirectX::BoundingOrientedBox* boxes, size_t count,
+        DirectX::FXMVECTOR color = DirectX::Colors::White);
+
+    void Draw(_In_ DebugDrawRecorder* recorder,
+        _In_reads_(count) const DirectX::BoundingOrientedBox* boxes, size_t count,
+        _In_reads_(count) const DirectX::XMFLOAT4* colors);
+
+    // Debug geometry which is kept across frames rather than regenerated, such as grids and nav mesh
+    // outlines. Lines are added either for a duration or until removed. With a device, lines without a
+    // lifetime are kept in a vertex buffer which is only rebuilt when they change.
+    class DebugDrawRetained
+    {
+    public:
+        using Handle = uint64_t;
+
+        static constexpr Handle c_InvalidHandle = 0;
+        static constexpr float c_UntilRemoved = FLT_MAX;
+
+        struct Stats
+        {
+            size_t      entries;
+            size_t      cachedVertices;     // Drawn from the vertex buffer by the last Draw(context)
+            size_t      batchedVertices;    // Copied into the batch by the last Draw(batch)
+        };
+
+        DebugDrawRetained() noexcept;
+        ~DebugDrawRetained() = default;
+
+        DebugDrawRetained(DebugDrawRetained&&) = default;
+        DebugDrawRetained& operator= (DebugDrawRetained&&) = default;
+
+        DebugDrawRetained(DebugDrawRetained const&) = delete;
+        DebugDrawRetained& operator= (DebugDrawRetained const&) = delete;
+
+        void SetDevice(_In_ ID3D11Device* device);
+        void ReleaseDevice() noexcept;
+
+        // Adds line list vertices, in pairs
+        Handle Add(
+            _In_reads_(count) const DirectX::VertexPositionColor* lines,
+            size_t count,
+            float duration = c_UntilRemoved);
+
+        // Takes everything recorded so far, so any of the shape functions can be used to build the geometry
+        Handle Add(DebugDrawRecorder& recorder, float duration = c_UntilRemoved);
+
+        bool Remove(Handle handle) noexcept;
+        void Clear() noexcept;
+
+        // Counts down the lines added with a duration, and removes those which have expired
+        void Update(float elapsedSeconds);
+
+        // Draws the cached vertex buffer with the effect and input layout already set for
+        // VertexPositionColor. Call outside of PrimitiveBatch Begin/End.
+        void Draw(_In_ ID3D11DeviceContext* context);
+
+        // Draws the lines which aren't in the vertex buffer, which is all of them without a device. Each draw
+        // fits in a batch created with maxVertices, as for DebugDrawRecorder::Flush. Returns the number of
+        // vertices drawn.
+        size_t Draw(_In_ DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch, size_t maxVertices = 4096);
+
+        Stats GetStats() const noexcept;
+
+    private:
+        struct Entry
+        {
+            Handle                                      handle;
+            float                                       remaining;
+            std::vector<DirectX::VertexPositionColor>   lines;
+        };
+
+        Handle Insert(Entry&& entry);
+
+        Microsoft::WRL::ComPtr<ID3D11Device>    m_device;
+        Microsoft::WRL::ComPtr<ID3D11Buffer>    m_vertexBuffer;
+        std::vector<Entry>                      m_entries;
+        Handle                                  m_nextHandle;
+        size_t                                  m_cachedVertices;
+        bool                                    m_cacheDirty;
+        Stats                                   m_stats;
+    };
 }
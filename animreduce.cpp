@@ -0,0 +1,582 @@
+//--------------------------------------------------------------------------------------
+// File: animreduce.cpp
+//
+// Keyframe reduction utility for SDKMESH_ANIM and CMO animation data
+//
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//--------------------------------------------------------------------------------------
+
+#include <Windows.h>
+
+#include <DirectXMath.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <fstream>
+#include <vector>
+
+using namespace DirectX;
+
+//--------------------------------------------------------------------------------------
+// File structures, which match those read by Animation.cpp
+//--------------------------------------------------------------------------------------
+namespace
+{
+#pragma pack(push,8)
+
+    constexpr uint32_t SDKMESH_FILE_VERSION = 101;
+    constexpr uint32_t MAX_FRAME_NAME = 100;
+
+    struct SDKANIMATION_FILE_HEADER
+    {
+        uint32_t Version;
+        uint8_t  IsBigEndian;
+        uint32_t FrameTransformType;
+        uint32_t NumFrames;
+        uint32_t NumAnimationKeys;
+        uint32_t AnimationFPS;
+        uint64_t AnimationDataSize;
+        uint64_t AnimationDataOffset;
+    };
+
+    static_assert(sizeof(SDKANIMATION_FILE_HEADER) == 40, "SDK Mesh structure size incorrect");
+
+    struct SDKANIMATION_DATA
+    {
+        XMFLOAT3 Translation;
+        XMFLOAT4 Orientation;
+        XMFLOAT3 Scaling;
+    };
+
+    static_assert(sizeof(SDKANIMATION_DATA) == 40, "SDK Mesh structure size incorrect");
+
+    struct SDKANIMATION_FRAME_DATA
+    {
+        char FrameName[MAX_FRAME_NAME];
+        uint64_t DataOffset;
+    };
+
+    static_assert(sizeof(SDKANIMATION_FRAME_DATA) == 112, "SDK Mesh structure size incorrect");
+
+#pragma pack(pop)
+
+#pragma pack(push,1)
+
+    struct Clip
+    {
+        float StartTime;
+        float EndTime;
+        uint32_t keys;
+    };
+
+    static_assert(sizeof(Clip) == 12, "CMO Mesh structure size incorrect");
+
+    struct Keyframe
+    {
+        uint32_t BoneIndex;
+        float Time;
+        XMFLOAT4X4 Transform;
+    };
+
+    static_assert(sizeof(Keyframe) == 72, "CMO Mesh structure size incorrect");
+
+#pragma pack(pop)
+}
+
+//--------------------------------------------------------------------------------------
+namespace
+{
+    constexpr float c_DefaultTolerance = 0.0005f;
+
+    bool LoadBlob(const wchar_t* fileName, std::vector<uint8_t>& data)
+    {
+        std::ifstream inFile(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!inFile)
+            return false;
+
+        const std::streampos len = inFile.tellg();
+        if (!inFile)
+            return false;
+
+        data.resize(static_cast<size_t>(len));
+
+        inFile.seekg(0, std::ios::beg);
+        inFile.read(reinterpret_cast<char*>(data.data()), len);
+
+        return !inFile.fail();
+    }
+
+    bool SaveBlob(const wchar_t* fileName, const std::vector<uint8_t>& data)
+    {
+        std::ofstream outFile(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!outFile)
+            return false;
+
+        outFile.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+        return !outFile.fail();
+    }
+
+    template<typename T>
+    void Append(std::vector<uint8_t>& data, const T* values, size_t count)
+    {
+        auto ptr = reinterpret_cast<const uint8_t*>(values);
+        data.insert(data.end(), ptr, ptr + sizeof(T) * count);
+    }
+
+    // Same composition as AnimationCMO uses when playing back decomposed keys
+    inline XMMATRIX XM_CALLCONV ComposeTransform(FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation) noexcept
+    {
+        return XMMatrixMultiply(
+            XMMatrixMultiply(XMMatrixScalingFromVector(scale), XMMatrixRotationQuaternion(rotation)),
+            XMMatrixTranslationFromVector(translation));
+    }
+
+    inline float XM_CALLCONV MatrixError(FXMMATRIX a, CXMMATRIX b) noexcept
+    {
+        XMVECTOR error = XMVectorZero();
+        for (size_t r = 0; r < 4; ++r)
+        {
+            error = XMVectorMax(error, XMVectorAbs(XMVectorSubtract(a.r[r], b.r[r])));
+        }
+
+        XMFLOAT4 tmp;
+        XMStoreFloat4(&tmp, error);
+        return std::max(std::max(tmp.x, tmp.y), std::max(tmp.z, tmp.w));
+    }
+
+    inline float XM_CALLCONV QuaternionError(FXMVECTOR a, FXMVECTOR b) noexcept
+    {
+        XMVECTOR q = a;
+        if (XMVectorGetX(XMVector4Dot(a, b)) < 0.f)
+        {
+            q = XMVectorNegate(q);
+        }
+
+        XMFLOAT4 tmp;
+        XMStoreFloat4(&tmp, XMVectorAbs(XMVectorSubtract(q, b)));
+        return std::max(std::max(tmp.x, tmp.y), std::max(tmp.z, tmp.w));
+    }
+
+    //----------------------------------------------------------------------------------
+    // CMO
+    //----------------------------------------------------------------------------------
+    struct DecomposedKey
+    {
+        float       time;
+        XMFLOAT3    scale;
+        XMFLOAT4    rotation;
+        XMFLOAT3    translation;
+        XMFLOAT4X4  original;
+    };
+
+    // True if interpolating between keys a and b reproduces every key in between
+    bool SegmentFits(const std::vector<DecomposedKey>& keys, size_t a, size_t b, float tolerance)
+    {
+        const XMVECTOR scale0 = XMLoadFloat3(&keys[a].scale);
+        const XMVECTOR quat0 = XMLoadFloat4(&keys[a].rotation);
+        const XMVECTOR translation0 = XMLoadFloat3(&keys[a].translation);
+
+        const XMVECTOR scale1 = XMLoadFloat3(&keys[b].scale);
+        const XMVECTOR quat1 = XMLoadFloat4(&keys[b].rotation);
+        const XMVECTOR translation1 = XMLoadFloat3(&keys[b].translation);
+
+        const float time0 = keys[a].time;
+        const float time1 = keys[b].time;
+
+        for (size_t j = a + 1; j < b; ++j)
+        {
+            const float t = (time1 > time0) ? (keys[j].time - time0) / (time1 - time0) : 0.f;
+
+            const XMMATRIX m = ComposeTransform(
+                XMVectorLerp(scale0, scale1, t),
+                XMQuaternionSlerp(quat0, quat1, t),
+                XMVectorLerp(translation0, translation1, t));
+
+            if (MatrixError(m, XMLoadFloat4x4(&keys[j].original)) > tolerance)
+                return false;
+        }
+
+        return true;
+    }
+
+    // True if holding key a reproduces every key after it, since playback holds the last key
+    bool HoldFits(const std::vector<DecomposedKey>& keys, size_t a, float tolerance)
+    {
+        const XMMATRIX m = ComposeTransform(
+            XMLoadFloat3(&keys[a].scale),
+            XMLoadFloat4(&keys[a].rotation),
+            XMLoadFloat3(&keys[a].translation));
+
+        for (size_t j = a + 1; j < keys.size(); ++j)
+        {
+            if (MatrixError(m, XMLoadFloat4x4(&keys[j].original)) > tolerance)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Marks which keys of one bone to keep, given the bone's key indices sorted by time. Bones with keys
+    // that can't be decomposed within the tolerance keep all of them.
+    void ReduceBone(
+        const Keyframe* clipKeys,
+        const std::vector<uint32_t>& indices,
+        float tolerance,
+        std::vector<bool>& keep)
+    {
+        std::vector<DecomposedKey> keys(indices.size());
+
+        for (size_t j = 0; j < indices.size(); ++j)
+        {
+            const Keyframe& src = clipKeys[indices[j]];
+            const XMMATRIX m = XMLoadFloat4x4(&src.Transform);
+
+            XMVECTOR scale, quat, translation;
+            if (!XMMatrixDecompose(&scale, &quat, &translation, m)
+                || MatrixError(ComposeTransform(scale, quat, translation), m) > tolerance)
+            {
+                for (auto it : indices)
+                {
+                    keep[it] = true;
+                }
+                return;
+            }
+
+            keys[j].time = src.Time;
+            XMStoreFloat3(&keys[j].scale, scale);
+            XMStoreFloat4(&keys[j].rotation, quat);
+            XMStoreFloat3(&keys[j].translation, translation);
+            keys[j].original = src.Transform;
+        }
+
+        // Greedily extend each segment from the last kept key for as long as interpolation fits
+        size_t anchor = 0;
+        size_t previous = 0;
+        keep[indices[0]] = true;
+
+        while (anchor + 1 < keys.size())
+        {
+            size_t end = anchor + 1;
+            while (end + 1 < keys.size() && SegmentFits(keys, anchor, end + 1, tolerance))
+            {
+                ++end;
+            }
+
+            keep[indices[end]] = true;
+            previous = anchor;
+            anchor = end;
+        }
+
+        if (anchor > 0 && HoldFits(keys, previous, tolerance))
+        {
+            keep[indices[anchor]] = false;
+        }
+    }
+
+    int ReduceCMO(const wchar_t* inFile, const wchar_t* outFile, size_t offset, float tolerance)
+    {
+        std::vector<uint8_t> data;
+        if (!LoadBlob(inFile, data))
+        {
+            wprintf(L"ERROR: Failed to read %ls\n", inFile);
+            return 1;
+        }
+
+        if (offset + sizeof(uint32_t) > data.size())
+        {
+            wprintf(L"ERROR: Animation offset %zu is beyond the end of %ls\n", offset, inFile);
+            return 1;
+        }
+
+        // Everything before the animation section is copied unchanged
+        std::vector<uint8_t> result(data.cbegin(), data.cbegin() + ptrdiff_t(offset));
+
+        const uint8_t* ptr = data.data() + offset;
+        const uint8_t* end = data.data() + data.size();
+
+        uint32_t nClips = 0;
+        memcpy(&nClips, ptr, sizeof(uint32_t));
+        ptr += sizeof(uint32_t);
+        Append(result, &nClips, 1);
+
+        size_t totalKeys = 0;
+        size_t totalKept = 0;
+
+        for (uint32_t c = 0; c < nClips; ++c)
+        {
+            uint32_t nName = 0;
+            if (size_t(end - ptr) < sizeof(uint32_t))
+            {
+                wprintf(L"ERROR: Unexpected end of file reading clip %u\n", c);
+                return 1;
+            }
+
+            memcpy(&nName, ptr, sizeof(uint32_t));
+            ptr += sizeof(uint32_t);
+
+            if (size_t(end - ptr) < sizeof(wchar_t) * nName + sizeof(Clip))
+            {
+                wprintf(L"ERROR: Unexpected end of file reading clip %u\n", c);
+                return 1;
+            }
+
+            std::vector<wchar_t> name(size_t(nName) + 1, 0);
+            memcpy(name.data(), ptr, sizeof(wchar_t) * nName);
+            ptr += sizeof(wchar_t) * nName;
+
+            Clip clip = {};
+            memcpy(&clip, ptr, sizeof(Clip));
+            ptr += sizeof(Clip);
+
+            if (size_t(end - ptr) < sizeof(Keyframe) * clip.keys)
+            {
+                wprintf(L"ERROR: Unexpected end of file reading keys for clip %u\n", c);
+                return 1;
+            }
+
+            std::vector<Keyframe> keys(clip.keys);
+            memcpy(keys.data(), ptr, sizeof(Keyframe) * clip.keys);
+            ptr += sizeof(Keyframe) * clip.keys;
+
+            // Group the keys by bone and sort by time, as AnimationCMO::Load does
+            std::vector<uint32_t> order(clip.keys);
+            for (uint32_t k = 0; k < clip.keys; ++k)
+            {
+                order[k] = k;
+            }
+
+            std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b)
+                {
+                    if (keys[a].BoneIndex != keys[b].BoneIndex)
+                        return keys[a].BoneIndex < keys[b].BoneIndex;
+
+                    return keys[a].Time < keys[b].Time;
+                });
+
+            std::vector<bool> keep(clip.keys, false);
+            std::vector<uint32_t> indices;
+
+            for (size_t k = 0; k < order.size(); )
+            {
+                const uint32_t bone = keys[order[k]].BoneIndex;
+
+                indices.clear();
+                for (; k < order.size() && keys[order[k]].BoneIndex == bone; ++k)
+                {
+                    indices.push_back(order[k]);
+                }
+
+                ReduceBone(keys.data(), indices, tolerance, keep);
+            }
+
+            // Kept keys are written in their original order
+            std::vector<Keyframe> kept;
+            kept.reserve(keys.size());
+            for (uint32_t k = 0; k < clip.keys; ++k)
+            {
+                if (keep[k])
+                {
+                    kept.push_back(keys[k]);
+                }
+            }
+
+            wprintf(L"Clip '%ls': %u keys reduced to %zu\n", name.data(), clip.keys, kept.size());
+
+            totalKeys += clip.keys;
+            totalKept += kept.size();
+
+            clip.keys = static_cast<uint32_t>(kept.size());
+
+            Append(result, &nName, 1);
+            Append(result, name.data(), nName);
+            Append(result, &clip, 1);
+            Append(result, kept.data(), kept.size());
+        }
+
+        // Preserve anything which follows the clips
+        result.insert(result.end(), ptr, end);
+
+        if (!SaveBlob(outFile, result))
+        {
+            wprintf(L"ERROR: Failed to write %ls\n", outFile);
+            return 1;
+        }
+
+        wprintf(L"%zu keys reduced to %zu, file size %zu bytes reduced to %zu\n",
+            totalKeys, totalKept, data.size(), result.size());
+        wprintf(L"Load the result with AnimationLoader_InterpolateKeys\n");
+
+        return 0;
+    }
+
+    //----------------------------------------------------------------------------------
+    // SDKMESH_ANIM
+    //----------------------------------------------------------------------------------
+
+    // True if two tracks match within the tolerance for every key
+    bool TracksMatch(const SDKANIMATION_DATA* a, const SDKANIMATION_DATA* b, uint32_t keyCount, float tolerance)
+    {
+        const XMVECTOR epsilon = XMVectorReplicate(tolerance);
+
+        for (uint32_t k = 0; k < keyCount; ++k)
+        {
+            if (!XMVector3NearEqual(XMLoadFloat3(&a[k].Translation), XMLoadFloat3(&b[k].Translation), epsilon)
+                || !XMVector3NearEqual(XMLoadFloat3(&a[k].Scaling), XMLoadFloat3(&b[k].Scaling), epsilon))
+                return false;
+
+            if (QuaternionError(XMLoadFloat4(&a[k].Orientation), XMLoadFloat4(&b[k].Orientation)) > tolerance)
+                return false;
+        }
+
+        return true;
+    }
+
+    // The fixed key rate means every track must have a key for every tick, so tracks can't be thinned.
+    // Instead, tracks which match within the tolerance share a single copy of the key data.
+    int ReduceSDKMESH(const wchar_t* inFile, const wchar_t* outFile, float tolerance)
+    {
+        std::vector<uint8_t> data;
+        if (!LoadBlob(inFile, data))
+        {
+            wprintf(L"ERROR: Failed to read %ls\n", inFile);
+            return 1;
+        }
+
+        if (data.size() < sizeof(SDKANIMATION_FILE_HEADER))
+        {
+            wprintf(L"ERROR: File too small for valid animation - %ls\n", inFile);
+            return 1;
+        }
+
+        SDKANIMATION_FILE_HEADER header = {};
+        memcpy(&header, data.data(), sizeof(header));
+
+        if (header.Version != SDKMESH_FILE_VERSION
+            || header.IsBigEndian != 0
+            || header.FrameTransformType != 0 /*FTT_RELATIVE*/
+            || header.NumAnimationKeys == 0
+            || header.NumFrames == 0
+            || header.AnimationFPS == 0)
+        {
+            wprintf(L"ERROR: Unsupported animation file - %ls\n", inFile);
+            return 1;
+        }
+
+        if (header.AnimationDataOffset + sizeof(SDKANIMATION_FRAME_DATA) * uint64_t(header.NumFrames) > data.size())
+        {
+            wprintf(L"ERROR: Unexpected end of file reading frames\n");
+            return 1;
+        }
+
+        std::vector<SDKANIMATION_FRAME_DATA> frames(header.NumFrames);
+        memcpy(frames.data(), data.data() + header.AnimationDataOffset, sizeof(SDKANIMATION_FRAME_DATA) * header.NumFrames);
+
+        const size_t trackSize = sizeof(SDKANIMATION_DATA) * header.NumAnimationKeys;
+
+        std::vector<const SDKANIMATION_DATA*> tracks(header.NumFrames);
+        for (size_t j = 0; j < header.NumFrames; ++j)
+        {
+            const uint64_t offset = sizeof(SDKANIMATION_FILE_HEADER) + frames[j].DataOffset;
+            if (offset + trackSize > data.size())
+            {
+                wprintf(L"ERROR: Unexpected end of file reading track %zu\n", j);
+                return 1;
+            }
+
+            tracks[j] = reinterpret_cast<const SDKANIMATION_DATA*>(data.data() + offset);
+        }
+
+        // Layout is header, frame table, then the unique tracks
+        const size_t frameTableOffset = sizeof(SDKANIMATION_FILE_HEADER);
+        const size_t keysOffset = frameTableOffset + sizeof(SDKANIMATION_FRAME_DATA) * header.NumFrames;
+
+        std::vector<uint8_t> keyData;
+        std::vector<size_t> unique;
+
+        for (size_t j = 0; j < header.NumFrames; ++j)
+        {
+            auto it = std::find_if(unique.cbegin(), unique.cend(), [&](size_t u)
+                {
+                    return TracksMatch(tracks[j], tracks[u], header.NumAnimationKeys, tolerance);
+                });
+
+            if (it != unique.cend())
+            {
+                frames[j].DataOffset = frames[*it].DataOffset;
+                continue;
+            }
+
+            frames[j].DataOffset = keysOffset + keyData.size() - sizeof(SDKANIMATION_FILE_HEADER);
+            Append(keyData, tracks[j], header.NumAnimationKeys);
+            unique.push_back(j);
+        }
+
+        header.AnimationDataOffset = frameTableOffset;
+        header.AnimationDataSize = keysOffset + keyData.size() - frameTableOffset;
+
+        std::vector<uint8_t> result;
+        result.reserve(keysOffset + keyData.size());
+        Append(result, &header, 1);
+        Append(result, frames.data(), frames.size());
+        result.insert(result.end(), keyData.cbegin(), keyData.cend());
+
+        if (!SaveBlob(outFile, result))
+        {
+            wprintf(L"ERROR: Failed to write %ls\n", outFile);
+            return 1;
+        }
+
+        wprintf(L"%u tracks share %zu unique key sets, file size %zu bytes reduced to %zu\n",
+            header.NumFrames, unique.size(), data.size(), result.size());
+
+        return 0;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+int wmain(int argc, wchar_t* argv[], wchar_t* envp[])
+{
+    UNREFERENCED_PARAMETER(envp);
+
+    float tolerance = c_DefaultTolerance;
+    size_t cmoOffset = 0;
+    bool cmo = false;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == L'-'; ++arg)
+    {
+        if (!_wcsicmp(argv[arg], L"-t") && arg + 1 < argc)
+        {
+            tolerance = wcstof(argv[++arg], nullptr);
+        }
+        else if (!_wcsicmp(argv[arg], L"-cmo") && arg + 1 < argc)
+        {
+            cmoOffset = static_cast<size_t>(_wcstoui64(argv[++arg], nullptr, 0));
+            cmo = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (argc - arg != 2 || !(tolerance > 0.f) || (cmo && !cmoOffset))
+    {
+        wprintf(L"Usage: animreduce [-t <tolerance>] [-cmo <offset>] <input> <output>\n\n");
+        wprintf(L"   -t <tolerance>   largest allowed error per matrix or key component (default %g)\n", double(c_DefaultTolerance));
+        wprintf(L"   -cmo <offset>    input is a CMO with animation clips at this offset (animsOffset from Model::CreateFromCMO)\n");
+        wprintf(L"                    otherwise the input is a SDKMESH_ANIM\n\n");
+        wprintf(L"A reduced CMO must be loaded with AnimationLoader_InterpolateKeys, otherwise playback holds each key\n");
+        return 1;
+    }
+
+    const wchar_t* inFile = argv[arg];
+    const wchar_t* outFile = argv[arg + 1];
+
+    return (cmo) ? ReduceCMO(inFile, outFile, cmoOffset, tolerance) : ReduceSDKMESH(inFile, outFile, tolerance);
+}
@@ -0,0 +1,191 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//
+// Checks that a single SDKMESH layer blended at full weight gives the same palette as playing it directly.
+
+#include "pch.h"
+
+#include "Animation.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+#pragma pack(push,8)
+
+    // Same layout as the SDKMESH animation structures in Animation.cpp
+    struct FileHeader
+    {
+        uint32_t Version;
+        uint8_t  IsBigEndian;
+        uint32_t FrameTransformType;
+        uint32_t NumFrames;
+        uint32_t NumAnimationKeys;
+        uint32_t AnimationFPS;
+        uint64_t AnimationDataSize;
+        uint64_t AnimationDataOffset;
+    };
+
+    struct KeyData
+    {
+        XMFLOAT3 Translation;
+        XMFLOAT4 Orientation;
+        XMFLOAT3 Scaling;
+    };
+
+    struct FrameData
+    {
+        char FrameName[100];
+        uint64_t DataOffset;
+    };
+
+#pragma pack(pop)
+
+    static_assert(sizeof(FileHeader) == 40 && sizeof(KeyData) == 40 && sizeof(FrameData) == 112,
+        "SDKMESH structure size incorrect");
+
+    // One key for each of two tracks, with non-uniform scale so the composition order matters
+    bool WriteClip(const wchar_t* fileName)
+    {
+        const char* names[2] = { "Root", "Arm" };
+
+        XMFLOAT4 rotation0, rotation1;
+        XMStoreFloat4(&rotation0, XMQuaternionRotationRollPitchYaw(0.3f, 0.7f, -0.2f));
+        XMStoreFloat4(&rotation1, XMQuaternionRotationRollPitchYaw(-0.5f, 0.1f, 0.9f));
+
+        const KeyData keys[2] =
+        {
+            { XMFLOAT3(1.f, 2.f, 3.f), rotation0, XMFLOAT3(1.f, 2.f, 0.5f) },
+            { XMFLOAT3(0.f, 4.f, 0.f), rotation1, XMFLOAT3(3.f, 1.f, 1.5f) },
+        };
+
+        FrameData frames[2] = {};
+        for (size_t j = 0; j < 2; ++j)
+        {
+            strcpy_s(frames[j].FrameName, names[j]);
+            frames[j].DataOffset = sizeof(KeyData) * j;
+        }
+
+        FileHeader header = {};
+        header.Version = 101;
+        header.NumFrames = 2;
+        header.NumAnimationKeys = 1;
+        header.AnimationFPS = 30;
+        header.AnimationDataOffset = sizeof(FileHeader) + sizeof(keys);
+        header.AnimationDataSize = sizeof(frames);
+
+        FILE* file = nullptr;
+        if (_wfopen_s(&file, fileName, L"wb") != 0 || !file)
+            return false;
+
+        const bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(keys, sizeof(keys), 1, file) == 1
+            && fwrite(frames, sizeof(frames), 1, file) == 1;
+
+        fclose(file);
+        return ok;
+    }
+
+    bool NearEqual(const XMMATRIX* a, const XMMATRIX* b, size_t count)
+    {
+        for (size_t j = 0; j < count; ++j)
+        {
+            XMFLOAT4X4 fa, fb;
+            XMStoreFloat4x4(&fa, a[j]);
+            XMStoreFloat4x4(&fb, b[j]);
+
+            for (size_t r = 0; r < 4; ++r)
+            {
+                for (size_t c = 0; c < 4; ++c)
+                {
+                    if (fabsf(fa.m[r][c] - fb.m[r][c]) > 1e-4f)
+                    {
+                        printf("Bone %zu differs at [%zu][%zu]: %f vs %f\n", j, r, c, double(fa.m[r][c]), double(fb.m[r][c]));
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+}
+
+int main()
+{
+    wchar_t tempPath[MAX_PATH] = {};
+    if (!GetTempPathW(MAX_PATH, tempPath))
+        return 1;
+
+    const std::wstring fileName = std::wstring(tempPath) + L"animationblendtest.sdkmesh_anim";
+    if (!WriteClip(fileName.c_str()))
+    {
+        printf("FAILED: couldn't write the test clip\n");
+        return 1;
+    }
+
+    std::shared_ptr<const DX::AnimationClipSDKMESH> clip;
+    const HRESULT hr = DX::AnimationClipSDKMESH::CreateFromFile(fileName.c_str(), clip);
+    DeleteFileW(fileName.c_str());
+
+    if (FAILED(hr))
+    {
+        printf("FAILED: couldn't load the test clip (%08X)\n", static_cast<unsigned int>(hr));
+        return 1;
+    }
+
+    // The last bone isn't animated, and its bind pose has shear so it can't be decomposed exactly
+    constexpr size_t nbones = 3;
+    const wchar_t* names[nbones] = { L"Root", L"Arm", L"Tip" };
+    const uint32_t parents[nbones] = { ModelBone::c_Invalid, 0, 1 };
+
+    Model model;
+    model.boneMatrices = ModelBone::MakeArray(nbones);
+    model.invBindPoseMatrices = ModelBone::MakeArray(nbones);
+    for (size_t j = 0; j < nbones; ++j)
+    {
+        ModelBone bone;
+        bone.parentIndex = parents[j];
+        bone.name = names[j];
+        model.bones.push_back(bone);
+
+        model.boneMatrices[j] = XMMatrixIdentity();
+        model.invBindPoseMatrices[j] = XMMatrixIdentity();
+    }
+
+    model.boneMatrices[2] = XMMatrixSet(
+        1.f, 0.5f, 0.f, 0.f,
+        0.f, 1.f, 0.f, 0.f,
+        0.f, 0.f, 1.f, 0.f,
+        0.f, 1.f, 0.f, 1.f);
+
+    DX::AnimationSDKMESH anim;
+    anim.SetClip(clip);
+    if (!anim.Bind(model))
+    {
+        printf("FAILED: clip didn't bind to the model\n");
+        return 1;
+    }
+
+    auto expected = ModelBone::MakeArray(nbones);
+    anim.Apply(model, nbones, expected.get());
+
+    const DX::AnimationBlend::Layer layer = { &anim, nullptr, 1.f, nullptr };
+
+    auto blended = ModelBone::MakeArray(nbones);
+    DX::AnimationBlend::Apply(model, &layer, 1, nbones, blended.get());
+
+    if (!NearEqual(blended.get(), expected.get(), nbones))
+    {
+        printf("FAILED: a single layer at full weight doesn't match Apply\n");
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
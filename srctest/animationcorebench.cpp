@@ -0,0 +1,83 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//
+// Times pose evaluation with the portable skeleton core.
+//
+// Usage: animationcorebench [bones] [iterations]
+
+#include "AnimationCore.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace DirectX;
+
+int main(int argc, char* argv[])
+{
+    const size_t nbones = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 100;
+    const size_t iterations = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 100000;
+
+    if (!nbones || !iterations)
+    {
+        printf("Usage: animationcorebench [bones] [iterations]\n");
+        return 1;
+    }
+
+    // A branching hierarchy, stored children first so the skeleton has to sort it
+    std::vector<uint32_t> parents(nbones);
+    std::vector<XMMATRIX> invBindPose(nbones, XMMatrixIdentity());
+    for (size_t j = 0; j < nbones; ++j)
+    {
+        const size_t index = nbones - 1 - j;
+        parents[j] = (index > 0) ? static_cast<uint32_t>(nbones - 1 - (index - 1) / 2) : DX::AnimationSkeleton::c_InvalidBone;
+    }
+
+    DX::AnimationSkeletonDesc desc = {};
+    desc.boneCount = nbones;
+    desc.parents = parents.data();
+    desc.invBindPose = invBindPose.data();
+
+    const DX::AnimationSkeleton skeleton(desc);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+
+    std::vector<DX::AnimationLocalTransform> pose(nbones);
+    for (auto& bone : pose)
+    {
+        bone.scale = g_XMOne;
+        bone.rotation = XMQuaternionNormalize(XMVectorSet(dist(rng), dist(rng), dist(rng), 1.f));
+        bone.translation = XMVectorSet(dist(rng), dist(rng), dist(rng), 0.f);
+    }
+
+    std::vector<XMMATRIX> absolute(nbones);
+    std::vector<XMMATRIX> boneTransforms(nbones);
+
+    // Warm up the caches before timing
+    DX::EvaluatePose(skeleton, pose.data(), absolute.data(), boneTransforms.data());
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t k = 0; k < iterations; ++k)
+    {
+        DX::EvaluatePose(skeleton, pose.data(), absolute.data(), boneTransforms.data());
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+
+    // Keeps the result live so the loop isn't optimized away
+    XMFLOAT4X4 last;
+    XMStoreFloat4x4(&last, boneTransforms[nbones - 1]);
+
+    const double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%zu bones, %zu iterations: %.1f ns per pose, %.2f ns per bone (%f)\n",
+        nbones, iterations,
+        ns / double(iterations),
+        ns / double(iterations * nbones),
+        double(last._41));
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+//
+// Checks the portable skeleton and pose evaluation core against hand-computed transforms.
+
+#include "AnimationCore.h"
+
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <stdexcept>
+
+using namespace DirectX;
+using DX::AnimationSkeleton;
+
+namespace
+{
+    constexpr uint32_t c_Root = AnimationSkeleton::c_InvalidBone;
+
+    int s_failures = 0;
+
+    void Check(bool result, const char* what, int line)
+    {
+        if (!result)
+        {
+            printf("FAILED (line %d): %s\n", line, what);
+            ++s_failures;
+        }
+    }
+
+#define CHECK(x) Check((x), #x, __LINE__)
+
+    bool XM_CALLCONV NearEqual(FXMMATRIX m, const XMFLOAT4X4& expected)
+    {
+        XMFLOAT4X4 actual;
+        XMStoreFloat4x4(&actual, m);
+
+        for (size_t r = 0; r < 4; ++r)
+        {
+            for (size_t c = 0; c < 4; ++c)
+            {
+                if (fabsf(actual.m[r][c] - expected.m[r][c]) > 1e-5f)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename TException, typename TFunc>
+    bool Throws(TFunc&& func)
+    {
+        try
+        {
+            func();
+        }
+        catch (const TException&)
+        {
+            return true;
+        }
+        catch (...)
+        {
+        }
+        return false;
+    }
+
+    // Bone 0 is the child of bone 2, which is the child of the root bone 1, so the bones aren't stored
+    // parents first.
+    const uint32_t s_parents[3] = { 2, c_Root, 1 };
+
+    void TestEvaluationOrder()
+    {
+        DX::AnimationSkeletonDesc desc = {};
+        desc.boneCount = std::size(s_parents);
+        desc.parents = s_parents;
+
+        const AnimationSkeleton skeleton(desc);
+
+        CHECK(skeleton.GetBoneCount() == 3);
+
+        const uint32_t* order = skeleton.GetEvaluationOrder();
+        CHECK(order[0] == 1);
+        CHECK(order[1] == 2);
+        CHECK(order[2] == 0);
+
+        // Already sorted hierarchies keep their storage order
+        const uint32_t sorted[4] = { c_Root, 0, 0, 2 };
+        desc.boneCount = std::size(sorted);
+        desc.parents = sorted;
+
+        const AnimationSkeleton chain(desc);
+        for (uint32_t j = 0; j < 4; ++j)
+        {
+            CHECK(chain.GetEvaluationOrder()[j] == j);
+        }
+    }
+
+    void TestEvaluatePose()
+    {
+        const XMMATRIX invBindPose[3] =
+        {
+            XMMatrixIdentity(),
+            XMMatrixTranslation(-1.f, 0.f, 0.f),
+            XMMatrixIdentity(),
+        };
+
+        DX::AnimationSkeletonDesc desc = {};
+        desc.boneCount = std::size(s_parents);
+        desc.parents = s_parents;
+        desc.invBindPose = invBindPose;
+
+        const AnimationSkeleton skeleton(desc);
+
+        // Bone 1 moves along x, bone 2 turns 90 degrees about z and moves up y, bone 0 doubles in size and
+        // moves along z
+        const XMMATRIX local[3] =
+        {
+            XMMatrixMultiply(XMMatrixScaling(2.f, 2.f, 2.f), XMMatrixTranslation(0.f, 0.f, 3.f)),
+            XMMatrixTranslation(1.f, 0.f, 0.f),
+            XMMatrixMultiply(XMMatrixRotationZ(XM_PIDIV2), XMMatrixTranslation(0.f, 2.f, 0.f)),
+        };
+
+        const XMFLOAT4X4 expected[3] =
+        {
+            {
+                0.f, 2.f, 0.f, 0.f,
+                -2.f, 0.f, 0.f, 0.f,
+                0.f, 0.f, 2.f, 0.f,
+                1.f, 2.f, 3.f, 1.f
+            },
+            {
+                1.f, 0.f, 0.f, 0.f,
+                0.f, 1.f, 0.f, 0.f,
+                0.f, 0.f, 1.f, 0.f,
+                1.f, 0.f, 0.f, 1.f
+            },
+            {
+                0.f, 1.f, 0.f, 0.f,
+                -1.f, 0.f, 0.f, 0.f,
+                0.f, 0.f, 1.f, 0.f,
+                1.f, 2.f, 0.f, 1.f
+            },
+        };
+
+        XMMATRIX absolute[3];
+        XMMATRIX boneTransforms[3];
+        DX::EvaluatePose(skeleton, local, absolute, boneTransforms);
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            CHECK(NearEqual(absolute[j], expected[j]));
+        }
+
+        // The inverse bind pose cancels bone 1's translation
+        const XMFLOAT4X4 identity(
+            1.f, 0.f, 0.f, 0.f,
+            0.f, 1.f, 0.f, 0.f,
+            0.f, 0.f, 1.f, 0.f,
+            0.f, 0.f, 0.f, 1.f);
+        CHECK(NearEqual(boneTransforms[1], identity));
+        CHECK(NearEqual(boneTransforms[2], expected[2]));
+
+        // The same pose as separate components
+        const DX::AnimationLocalTransform pose[3] =
+        {
+            { XMVectorReplicate(2.f), XMQuaternionIdentity(), XMVectorSet(0.f, 0.f, 3.f, 0.f) },
+            { g_XMOne, XMQuaternionIdentity(), XMVectorSet(1.f, 0.f, 0.f, 0.f) },
+            { g_XMOne, XMQuaternionRotationAxis(g_XMIdentityR2, XM_PIDIV2), XMVectorSet(0.f, 2.f, 0.f, 0.f) },
+        };
+
+        XMMATRIX fromPose[3];
+        DX::EvaluatePose(skeleton, pose, fromPose);
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            CHECK(NearEqual(fromPose[j], expected[j]));
+        }
+    }
+
+    void TestInvalidSkeletons()
+    {
+        DX::AnimationSkeletonDesc desc = {};
+
+        // Parents are required
+        desc.boneCount = 2;
+        CHECK(Throws<std::invalid_argument>([&]() { AnimationSkeleton s(desc); }));
+
+        // Bones 0 and 1 are each other's parent
+        const uint32_t cycle[3] = { 1, 0, c_Root };
+        desc.boneCount = std::size(cycle);
+        desc.parents = cycle;
+        CHECK(Throws<std::runtime_error>([&]() { AnimationSkeleton s(desc); }));
+
+        const uint32_t self[1] = { 0 };
+        desc.boneCount = std::size(self);
+        desc.parents = self;
+        CHECK(Throws<std::runtime_error>([&]() { AnimationSkeleton s(desc); }));
+
+        const uint32_t outOfRange[2] = { c_Root, 5 };
+        desc.boneCount = std::size(outOfRange);
+        desc.parents = outOfRange;
+        CHECK(Throws<std::runtime_error>([&]() { AnimationSkeleton s(desc); }));
+
+        // Skinning transforms need the inverse bind pose, absolute transforms alone don't
+        desc.boneCount = std::size(s_parents);
+        desc.parents = s_parents;
+        const AnimationSkeleton skeleton(desc);
+
+        const XMMATRIX local[3] = { XMMatrixIdentity(), XMMatrixIdentity(), XMMatrixIdentity() };
+        XMMATRIX absolute[3];
+        XMMATRIX boneTransforms[3];
+        CHECK(Throws<std::invalid_argument>([&]() { DX::EvaluatePose(skeleton, local, absolute, boneTransforms); }));
+        CHECK(!Throws<std::exception>([&]() { DX::EvaluatePose(skeleton, local, absolute); }));
+    }
+
+    void TestNames()
+    {
+        CHECK(AnimationSkeleton::FoldName(L"Spine_Upper") == L"spine_upper");
+        CHECK(AnimationSkeleton::FoldName(L"HIPS01") == L"hips01");
+        CHECK(AnimationSkeleton::FoldName(L"").empty());
+
+        const wchar_t* names[4] = { L"Hips", L"Spine", nullptr, L"SPINE" };
+        const uint32_t parents[4] = { c_Root, 0, 1, 1 };
+
+        DX::AnimationSkeletonDesc desc = {};
+        desc.boneCount = std::size(parents);
+        desc.parents = parents;
+        desc.names = names;
+
+        const AnimationSkeleton skeleton(desc);
+
+        CHECK(skeleton.FindBone(L"hips") == 0);
+        CHECK(skeleton.FindBone(L"HiPs") == 0);
+        CHECK(skeleton.FindBone(AnimationSkeleton::FoldName(L"Hips")) == 0);
+
+        // First bone wins for duplicate names
+        CHECK(skeleton.FindBone(L"spine") == 1);
+
+        CHECK(skeleton.FindBone(L"Head") == AnimationSkeleton::c_InvalidBone);
+        CHECK(skeleton.FindBone(static_cast<const wchar_t*>(nullptr)) == AnimationSkeleton::c_InvalidBone);
+    }
+}
+
+int main()
+{
+    TestEvaluationOrder();
+    TestEvaluatePose();
+    TestInvalidSkeletons();
+    TestNames();
+
+    if (s_failures > 0)
+    {
+        printf("%d check(s) failed\n", s_failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
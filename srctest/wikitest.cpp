@@ -2,6 +2,11 @@
 // Licensed under the MIT License.
 
 #include "Animation.h"
+#include "AnimationAsyncLoader.h"
+#include "AnimationBounds.h"
+#include "AnimationCore.h"
+#include "AnimationJobs.h"
+#include "AnimationLOD.h"
 #include "AnimatedTexture.h"
 #include "ControllerFont.h"
 #include "DebugDraw.h"